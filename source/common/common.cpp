@@ -7,12 +7,13 @@
 #include "common.h"
 #include "configuration.h"
 #include "loader.h"
+#include "kabsch.h"
+#include "kdtree.h"
+#include "voxelgrid.h"
+#include "threadpool.h"
 
 namespace Common
 {
-	unsigned int randomSeed = 0;
-	std::mt19937 mtRandom = std::mt19937{ 0 };
-
 	std::vector<Point_f> LoadCloud(const std::string& path)
 	{
 		AssimpCloudLoader loader(path);
@@ -22,12 +23,12 @@ namespace Common
 			return std::vector<Point_f>();
 	}
 
-	std::vector<Point_f> GetSubcloud(const std::vector<Point_f>& cloud, int subcloudSize)
+	std::vector<Point_f> GetSubcloud(const std::vector<Point_f>& cloud, int subcloudSize, RandomStream& random)
 	{
 		if (subcloudSize >= cloud.size())
 			return cloud;
 
-		std::vector<int> subcloudIndices = GetRandomPermutationVector(static_cast<int>(cloud.size()));
+		std::vector<int> subcloudIndices = GetRandomPermutationVector(static_cast<int>(cloud.size()), random);
 		subcloudIndices.resize(subcloudSize);
 
 		std::vector<Point_f> subcloud(subcloudIndices.size());
@@ -94,13 +95,13 @@ namespace Common
 		return GetAlignedCloud(alignedCloud, massCenter * -1.f);
 	}
 
-	std::vector<Point_f> AddNoiseToCloud(const std::vector<Point_f>& cloud, float affectedPointsShare, float intensity)
+	std::vector<Point_f> AddNoiseToCloud(const std::vector<Point_f>& cloud, float affectedPointsShare, float intensity, RandomStream& random)
 	{
 		auto clone = cloud;
 		std::vector<bool> affectedPoints(cloud.size(), false);
 		const int affectedPointsCount = std::clamp(static_cast<int>(std::round(affectedPointsShare * cloud.size())), 0, static_cast<int>(cloud.size()));
 		std::transform(affectedPoints.begin(), affectedPoints.begin() + affectedPointsCount, affectedPoints.begin(), [](const bool& val) {return true; });
-		affectedPoints = ApplyPermutation(affectedPoints, GetRandomPermutationVector(affectedPoints.size()));
+		affectedPoints = ApplyPermutation(affectedPoints, GetRandomPermutationVector(static_cast<int>(affectedPoints.size()), random));
 
 		const float spread = CalculateCloudSpread(cloud);
 
@@ -112,13 +113,13 @@ namespace Common
 		{
 			if (affectedPoints[i])
 			{
-				clone[i] += Tests::GetRandomPoint(min, max);
+				clone[i] += Tests::GetRandomPoint(min, max, random);
 			}
 		}
 		return clone;
 	}
 
-	std::vector<Point_f> AddOutliersToCloud(const std::vector<Point_f>& cloud, int outliersCount)
+	std::vector<Point_f> AddOutliersToCloud(const std::vector<Point_f>& cloud, int outliersCount, RandomStream& random)
 	{
 		auto clone = cloud;
 
@@ -126,15 +127,17 @@ namespace Common
 
 		for (int i = 0; i < outliersCount; i++)
 		{
-			clone.push_back(Tests::GetRandomPoint(min, max));
+			clone.push_back(Tests::GetRandomPoint(min, max, random));
 		}
 		return clone;
 	}
 
 	std::pair<std::vector<Point_f>, std::vector<Point_f>> GetCloudsFromConfig(Configuration config)
 	{
-		randomSeed = config.RandomSeed.has_value() ? static_cast<unsigned int>(config.RandomSeed.value()) : std::random_device{}();
-		mtRandom = std::mt19937{ randomSeed };
+		SetRandomSeed(config.RandomSeed.has_value() ? static_cast<uint32_t>(config.RandomSeed.value()) : std::random_device{}());
+		RandomStream beforeRandom(GetRandomSeed(), RandomPurpose::CloudBefore);
+		RandomStream afterRandom(GetRandomSeed(), RandomPurpose::CloudAfter);
+		RandomStream transformationRandom(GetRandomSeed(), RandomPurpose::Transformation);
 
 		const auto sameClouds = config.BeforePath == config.AfterPath;
 
@@ -145,13 +148,13 @@ namespace Common
 		if (config.CloudBeforeResize.has_value())
 		{
 			const auto newSize = config.CloudBeforeResize.value();
-			before = GetSubcloud(before, newSize);
+			before = GetSubcloud(before, newSize, beforeRandom);
 		}
 
 		if (config.CloudAfterResize.has_value())
 		{
 			const auto newSize = config.CloudAfterResize.value();
-			after = GetSubcloud(after, newSize);
+			after = GetSubcloud(after, newSize, afterRandom);
 		}
 
 		// normalize clouds to standart value
@@ -163,22 +166,22 @@ namespace Common
 		}
 
 		// shuffle clouds
-		std::shuffle(before.begin(), before.end(), mtRandom);
-		std::shuffle(after.begin(), after.end(), mtRandom);
+		Shuffle(before.begin(), before.end(), beforeRandom);
+		Shuffle(after.begin(), after.end(), afterRandom);
 
 
 		if (config.NoiseAffectedPointsBefore.has_value())
 		{
-			before = AddNoiseToCloud(before, config.NoiseAffectedPointsBefore.value(), config.NoiseIntensityBefore);
+			before = AddNoiseToCloud(before, config.NoiseAffectedPointsBefore.value(), config.NoiseIntensityBefore, beforeRandom);
 		}
 
 		if (config.NoiseAffectedPointsAfter.has_value())
 		{
-			after = AddNoiseToCloud(after, config.NoiseAffectedPointsAfter.value(), config.NoiseIntensityAfter);
+			after = AddNoiseToCloud(after, config.NoiseAffectedPointsAfter.value(), config.NoiseIntensityAfter, afterRandom);
 		}
 		
-		before = AddOutliersToCloud(before, config.AdditionalOutliersBefore);
-		after = AddOutliersToCloud(after, config.AdditionalOutliersAfter);
+		before = AddOutliersToCloud(before, config.AdditionalOutliersBefore, beforeRandom);
+		after = AddOutliersToCloud(after, config.AdditionalOutliersAfter, afterRandom);
 
 		// apply transformation and return
 		if (config.Transformation.has_value())
@@ -194,8 +197,8 @@ namespace Common
 			const auto params = config.TransformationParameters.value();
 			const auto rotationVal = params.first;
 			const auto translationVal = params.second;
-			const auto rotation = Tests::GetRandomRotationMatrix(rotationVal);
-			const auto translation = Tests::GetRandomTranslationVector(translationVal);
+			const auto rotation = Tests::GetRandomRotationMatrix(rotationVal, transformationRandom);
+			const auto translation = Tests::GetRandomTranslationVector(translationVal, transformationRandom);
 
 			return std::make_pair(
 				before,
@@ -230,6 +233,18 @@ namespace Common
 		return clone;
 	}
 
+	void TransformCloud(const std::vector<Point_f>& cloud, const glm::mat3& rotationMatrix, const glm::vec3& translationVector, std::vector<Point_f>* result)
+	{
+		result->resize(cloud.size());
+		std::transform(cloud.begin(), cloud.end(), result->begin(), [&](const Point_f& p) { return TransformPoint(p, rotationMatrix, translationVector); });
+	}
+
+	void TransformCloud(const std::vector<Point_f>& cloud, const glm::mat3& rotationMatrix, const glm::vec3& translationVector, const float& scale, std::vector<Point_f>* result)
+	{
+		result->resize(cloud.size());
+		std::transform(cloud.begin(), cloud.end(), result->begin(), [&](const Point_f& p) { return TransformPoint(p, rotationMatrix, translationVector, scale); });
+	}
+
 	float GetMeanSquaredError(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const glm::mat4& matrix)
 	{
 		float diffSum = 0.0f;
@@ -256,7 +271,7 @@ namespace Common
 		return diffSum / cloudBefore.size();
 	}
 
-	float GetMeanSquaredError(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const std::vector<int>& correspondingIndexesBefore, const std::vector<int> correspondingIndexesAfter)
+	float GetMeanSquaredError(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const std::vector<int>& correspondingIndexesBefore, const std::vector<int>& correspondingIndexesAfter)
 	{
 		float diffSum = 0.0f;
 		for (int i = 0; i < correspondingIndexesBefore.size(); i++)
@@ -396,166 +411,136 @@ namespace Common
 		PrintMatrix(transform);
 	}
 
-	CorrespondingPointsTuple GetCorrespondingPointsSequential(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, float maxDistanceSquared)
+	// Brute force nearest neighbour, maxDistanceSquared is checked later when accepting pairs
+	int FindNearestBruteForce(const Point_f& point, const std::vector<Point_f>& cloud)
 	{
-		std::vector<Point_f> correspondingFromCloudBefore(cloudBefore.size());
-		std::vector<Point_f> correspondingFromCloudAfter(cloudBefore.size());
-		std::vector<int> correspondingIndexesBefore(cloudBefore.size());
-		std::vector<int> correspondingIndexesAfter(cloudBefore.size());
-		int correspondingCount = 0;
+		int closestIndex = -1;
+		float closestDistance = std::numeric_limits<float>::max();
 
-		for (int i = 0; i < cloudBefore.size(); i++)
+		for (int j = 0; j < cloud.size(); j++)
 		{
-			int closestIndex = -1;
-			float closestDistance = std::numeric_limits<float>::max();
+			float distance = (cloud[j] - point).LengthSquared();
 
-			for (int j = 0; j < cloudAfter.size(); j++)
+			if (distance < closestDistance)
 			{
-				float distance = (cloudAfter[j] - cloudBefore[i]).LengthSquared();
-
-				if (distance < closestDistance || closestIndex == -1)
-				{
-					closestDistance = distance;
-					closestIndex = j;
-				}
-			}
-			if (closestDistance < maxDistanceSquared && closestIndex >= 0)
-			{
-				correspondingFromCloudBefore[correspondingCount] = cloudBefore[i];
-				correspondingFromCloudAfter[correspondingCount] = cloudAfter[closestIndex];
-				correspondingIndexesBefore[correspondingCount] = i;
-				correspondingIndexesAfter[correspondingCount] = closestIndex;
-
-				correspondingCount++;
+				closestDistance = distance;
+				closestIndex = j;
 			}
 		}
 
-		correspondingFromCloudBefore.resize(correspondingCount);
-		correspondingFromCloudAfter.resize(correspondingCount);
-		correspondingIndexesBefore.resize(correspondingCount);
-		correspondingIndexesAfter.resize(correspondingCount);
-
-		return std::make_tuple(correspondingFromCloudBefore, correspondingFromCloudAfter, correspondingIndexesBefore, correspondingIndexesAfter);
+		return closestIndex;
 	}
 
-	CorrespondingPointsTuple GetCorrespondingPointsParallel(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, float maxDistanceSquared)
+	// find_nearest(point) returns index of the closest point in cloudAfter or -1
+	template<typename FindNearest>
+	void GetCorrespondingIndices(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, float maxDistanceSquared, bool parallel, const FindNearest& find_nearest, CorrespondingIndices* correspondences)
 	{
-		const auto threadCount = std::thread::hardware_concurrency();
-		std::vector<std::thread> workerThreads;
-
-		const auto get_correspondence_idx = [](Point_f sourcePoint, const std::vector<Point_f>& targetCloud) {
-			int closestIndex = -1;
-			float closestDistance = std::numeric_limits<float>::max();
-
-			for (int j = 0; j < targetCloud.size(); j++)
-			{
-				float distance = (targetCloud[j] - sourcePoint).LengthSquared();
-
-				if (distance < closestDistance)
-				{
-					closestDistance = distance;
-					closestIndex = j;
-				}
-			}
-
-			return closestIndex;
-		};
-
-		std::vector<int> correspondingIndices(cloudBefore.size());
+		auto& closestIndexes = correspondences->closestIndexes;
+		closestIndexes.resize(cloudBefore.size());
 
 		const auto calculate_correspondences = [&](int beginIndex, int endIndex) {
 			for (int i = beginIndex; i < endIndex; i++)
-				correspondingIndices[i] = get_correspondence_idx(cloudBefore[i], cloudAfter);
+				closestIndexes[i] = find_nearest(cloudBefore[i]);
 		};
 
-		const auto threadWorkLength = cloudBefore.size() / threadCount;
-		for (unsigned int i = 0; i < threadCount - 1; i++)
-			workerThreads.push_back(std::thread(calculate_correspondences, i * threadWorkLength, (i + 1) * threadWorkLength));
-
-		workerThreads.push_back(std::thread(calculate_correspondences, (threadCount - 1) * threadWorkLength, cloudBefore.size()));
-
-		for (unsigned int i = 0; i < threadCount; i++)
-			workerThreads[i].join();
+		if (parallel)
+			ThreadPool::GetInstance().ParallelFor(0, static_cast<int>(cloudBefore.size()), calculate_correspondences);
+		else
+			calculate_correspondences(0, static_cast<int>(cloudBefore.size()));
 
-		std::vector<Point_f> correspondingFromCloudBefore(cloudBefore.size());
-		std::vector<Point_f> correspondingFromCloudAfter(cloudBefore.size());
-		std::vector<int> correspondingIndexesBefore(cloudBefore.size());
-		std::vector<int> correspondingIndexesAfter(cloudBefore.size());
-		int correspondingCount = 0;
+		// clear keeps capacity, so push_back does not allocate after the first call
+		correspondences->indexesBefore.clear();
+		correspondences->indexesAfter.clear();
+		correspondences->indexesBefore.reserve(cloudBefore.size());
+		correspondences->indexesAfter.reserve(cloudBefore.size());
 
 		for (int i = 0; i < cloudBefore.size(); i++)
 		{
-			const auto closestIndex = correspondingIndices[i];
+			const auto closestIndex = closestIndexes[i];
+			if (closestIndex < 0)
+				continue;
+
 			const auto distance = (cloudBefore[i] - cloudAfter[closestIndex]).LengthSquared();
 			if (distance < maxDistanceSquared)
 			{
-				correspondingFromCloudBefore[correspondingCount] = cloudBefore[i];
-				correspondingFromCloudAfter[correspondingCount] = cloudAfter[closestIndex];
-				correspondingIndexesBefore[correspondingCount] = i;
-				correspondingIndexesAfter[correspondingCount] = closestIndex;
-
-				correspondingCount++;
+				correspondences->indexesBefore.push_back(i);
+				correspondences->indexesAfter.push_back(closestIndex);
 			}
 		}
-
-		correspondingFromCloudBefore.resize(correspondingCount);
-		correspondingFromCloudAfter.resize(correspondingCount);
-		correspondingIndexesBefore.resize(correspondingCount);
-		correspondingIndexesAfter.resize(correspondingCount);
-
-		return std::make_tuple(correspondingFromCloudBefore, correspondingFromCloudAfter, correspondingIndexesBefore, correspondingIndexesAfter);
 	}
 
-	CorrespondingPointsTuple GetCorrespondingPoints(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, float maxDistanceSquared, bool parallel)
+	void GetCorrespondingIndices(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, float maxDistanceSquared, bool parallel, CorrespondingIndices* correspondences)
 	{
-		if (parallel)
-			return GetCorrespondingPointsParallel(cloudBefore, cloudAfter, maxDistanceSquared);
-		else
-			return GetCorrespondingPointsSequential(cloudBefore, cloudAfter, maxDistanceSquared);
+		const auto find_nearest = [&cloudAfter](const Point_f& point) { return FindNearestBruteForce(point, cloudAfter); };
+		GetCorrespondingIndices(cloudBefore, cloudAfter, maxDistanceSquared, parallel, find_nearest, correspondences);
 	}
 
-	std::pair<glm::mat3, glm::vec3> LeastSquaresSVD(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter)
+	void GetCorrespondingIndices(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const KdTree& cloudAfterIndex, float maxDistanceSquared, bool parallel, CorrespondingIndices* correspondences)
 	{
-		Eigen::Matrix3f rotationMatrix;// = Eigen::Matrix3f::Identity();
-		Eigen::Vector3f translationVector;// = Eigen::Vector3f::Zero();
-
-		auto centerBefore = GetCenterOfMass(cloudBefore);
-		auto centerAfter = GetCenterOfMass(cloudAfter);
-
-		const Eigen::Matrix3Xf alignedBefore = GetMatrix3XFromPointsVector(GetAlignedCloud(cloudBefore, centerBefore));
-		const Eigen::Matrix3Xf alignedAfter = GetMatrix3XFromPointsVector(GetAlignedCloud(cloudAfter, centerAfter));
+		const auto find_nearest = [&cloudAfterIndex, maxDistanceSquared](const Point_f& point) { return cloudAfterIndex.FindNearest(point, maxDistanceSquared); };
+		GetCorrespondingIndices(cloudBefore, cloudAfter, maxDistanceSquared, parallel, find_nearest, correspondences);
+	}
 
-		//version with thinU (docs say it should be enough for us, further efficiency tests are needed
-		// cheching option with MatrixXf instead od Matrix3f because documantation says: my matrix should have dynamic number of columns
-		const Eigen::MatrixXf matrix = alignedAfter * alignedBefore.transpose();
-		const Eigen::JacobiSVD<Eigen::MatrixXf> svd = Eigen::JacobiSVD<Eigen::MatrixXf>(matrix, Eigen::ComputeThinU | Eigen::ComputeThinV);
+	void GetCorrespondingIndices(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const VoxelGrid& cloudAfterGrid, float maxDistanceSquared, bool parallel, CorrespondingIndices* correspondences)
+	{
+		const auto find_nearest = [&cloudAfterGrid, maxDistanceSquared](const Point_f& point) { return cloudAfterGrid.FindNearest(point, maxDistanceSquared); };
+		GetCorrespondingIndices(cloudBefore, cloudAfter, maxDistanceSquared, parallel, find_nearest, correspondences);
+	}
 
-		//version with fullU
-		//const Eigen::Matrix3f matrix = alignedAfter * alignedBefore.transpose();
-		//const Eigen::JacobiSVD<Eigen::Matrix3f> svd = Eigen::JacobiSVD<Eigen::Matrix3f>(matrix, Eigen::ComputeFullU | Eigen::ComputeFullV);
+	// Copies points of index-only correspondences into tuple
+	CorrespondingPointsTuple GetCorrespondingPointsFromIndices(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const CorrespondingIndices& correspondences)
+	{
+		std::vector<Point_f> correspondingFromCloudBefore(correspondences.indexesBefore.size());
+		std::vector<Point_f> correspondingFromCloudAfter(correspondences.indexesAfter.size());
 
-		const Eigen::Matrix3f matrixU = svd.matrixU();
-		const Eigen::Matrix3f matrixV = svd.matrixV();
-		const Eigen::Matrix3f matrixVtransposed = matrixV.transpose();
+		for (int i = 0; i < correspondences.indexesBefore.size(); i++)
+		{
+			correspondingFromCloudBefore[i] = cloudBefore[correspondences.indexesBefore[i]];
+			correspondingFromCloudAfter[i] = cloudAfter[correspondences.indexesAfter[i]];
+		}
 
-		const Eigen::Matrix3f determinantMatrix = matrixU * matrixVtransposed;
+		return std::make_tuple(correspondingFromCloudBefore, correspondingFromCloudAfter, correspondences.indexesBefore, correspondences.indexesAfter);
+	}
 
-		const Eigen::Matrix3f diag = Eigen::DiagonalMatrix<float, 3>(1, 1, determinantMatrix.determinant());
+	CorrespondingPointsTuple GetCorrespondingPoints(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, float maxDistanceSquared, bool parallel)
+	{
+		CorrespondingIndices correspondences;
+		GetCorrespondingIndices(cloudBefore, cloudAfter, maxDistanceSquared, parallel, &correspondences);
+		return GetCorrespondingPointsFromIndices(cloudBefore, cloudAfter, correspondences);
+	}
 
-		rotationMatrix = matrixU * diag * matrixVtransposed;
+	CorrespondingPointsTuple GetCorrespondingPoints(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const KdTree& cloudAfterIndex, float maxDistanceSquared, bool parallel)
+	{
+		CorrespondingIndices correspondences;
+		GetCorrespondingIndices(cloudBefore, cloudAfter, cloudAfterIndex, maxDistanceSquared, parallel, &correspondences);
+		return GetCorrespondingPointsFromIndices(cloudBefore, cloudAfter, correspondences);
+	}
 
-		glm::mat3 rotationMatrixGLM = ConvertRotationMatrix(rotationMatrix);
+	CorrespondingPointsTuple GetCorrespondingPoints(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const VoxelGrid& cloudAfterGrid, float maxDistanceSquared, bool parallel)
+	{
+		CorrespondingIndices correspondences;
+		GetCorrespondingIndices(cloudBefore, cloudAfter, cloudAfterGrid, maxDistanceSquared, parallel, &correspondences);
+		return GetCorrespondingPointsFromIndices(cloudBefore, cloudAfter, correspondences);
+	}
 
-		glm::vec3 translationVectorGLM = glm::vec3(centerAfter) - (rotationMatrixGLM * centerBefore);
+	std::pair<glm::mat3, glm::vec3> LeastSquaresSVD(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter)
+	{
+		const auto accumulator = AccumulatePairs(static_cast<int>(cloudBefore.size()), false, [&](KabschAccumulator* partial, int i) {
+			partial->Add(cloudBefore[i], cloudAfter[i]);
+		});
+		return accumulator.GetTransformation();
+	}
 
-		return std::make_pair(rotationMatrixGLM, translationVectorGLM);
+	std::pair<glm::mat3, glm::vec3> LeastSquaresSVD(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const std::vector<int>& indexesBefore, const std::vector<int>& indexesAfter, bool parallel)
+	{
+		return AccumulateCorrespondences(cloudBefore, cloudAfter, indexesBefore, indexesAfter, parallel).GetTransformation();
 	}
 
-	std::vector<int> GetRandomPermutationVector(int size)
+	std::vector<int> GetRandomPermutationVector(int size, RandomStream& random)
 	{
 		std::vector<int> permutation(size);
 		std::iota(permutation.begin(), permutation.end(), 0);
-		std::shuffle(permutation.begin(), permutation.end(), mtRandom);
+		Shuffle(permutation.begin(), permutation.end(), random);
 		return permutation;
 	}
 
@@ -568,10 +553,4 @@ namespace Common
 		}
 		return inversedPermutation;
 	}
-
-	void SetRandom()
-	{
-		randomSeed = time(nullptr);
-		mtRandom = std::mt19937{ std::random_device{}() };
-	}
 }
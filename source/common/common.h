@@ -6,31 +6,45 @@
 
 #include "renderer.h"
 #include "shadertype.h"
+#include "randomstream.h"
 
 namespace Common
 {
 	struct Configuration;
+	class KdTree;
+	class VoxelGrid;
 	constexpr float CLOUD_BOUNDARY = 100.f;
 
 	typedef std::tuple<std::vector<Point_f>, std::vector<Point_f>, std::vector<int>, std::vector<int>> CorrespondingPointsTuple;
 
+	/// Index-only correspondences. Buffers keep their capacity between calls, so refilling them for the same cloud does not allocate
+	struct CorrespondingIndices
+	{
+		/// Closest point in cloudAfter of every point in cloudBefore, -1 when there is none
+		std::vector<int> closestIndexes;
+		/// Accepted pairs, indexesBefore[i] corresponds to indexesAfter[i]
+		std::vector<int> indexesBefore;
+		std::vector<int> indexesAfter;
+	};
+
 	/// Loads point cloud from .obj file
 	/// \param[in] path Relative path to file
 	std::vector<Point_f> LoadCloud(const std::string& path);
 
 	/// Returns random subcloud of given size
-	std::vector<Point_f> GetSubcloud(const std::vector<Point_f>& cloud, int subcloudSize);
+	std::vector<Point_f> GetSubcloud(const std::vector<Point_f>& cloud, int subcloudSize, RandomStream& random = GetDefaultRandomStream());
 
 	/// Normalizes the input cloud so it fits in cube with side of given size 
 	std::vector<Point_f> NormalizeCloud(const std::vector<Point_f>& cloud, float size);
 
 	/// Moves affectedPointsShare [0; 1] of cloud points by random vector that each element is smaller than cloudSpread * intensity
-	std::vector<Point_f> AddNoiseToCloud(const std::vector<Point_f>& cloud, float affectedPointsShare, float intensity);
+	std::vector<Point_f> AddNoiseToCloud(const std::vector<Point_f>& cloud, float affectedPointsShare, float intensity, RandomStream& random = GetDefaultRandomStream());
 
 	/// Adds outliersCount outliers to the cloud that are within boundaries of the cloud
-	std::vector<Point_f> AddOutliersToCloud(const std::vector<Point_f>& cloud, int outliersCount);
+	std::vector<Point_f> AddOutliersToCloud(const std::vector<Point_f>& cloud, int outliersCount, RandomStream& random = GetDefaultRandomStream());
 
-	/// Loads clouds and applies modifications according to configuration
+	/// Loads clouds and applies modifications according to configuration.
+	/// Every cloud is modified with its own stream of Configuration::RandomSeed, so results do not depend on order of modifications of the other one
 	std::pair<std::vector<Point_f>, std::vector<Point_f>> GetCloudsFromConfig(Configuration config);
 
 	// Transform cloud helpers
@@ -38,6 +52,9 @@ namespace Common
 	std::vector<Point_f> GetTransformedCloud(const std::vector<Point_f>& cloud, const glm::mat4& matrix);
 	std::vector<Point_f> GetTransformedCloud(const std::vector<Point_f>& cloud, const glm::mat3& rotationMatrix, const glm::vec3& translationVector);
 	std::vector<Point_f> GetTransformedCloud(const std::vector<Point_f>& cloud, const glm::mat3& rotationMatrix, const glm::vec3& translationVector, const float& scale);
+	/// Writes transformed cloud into result, which is only reallocated when it is smaller than cloud
+	void TransformCloud(const std::vector<Point_f>& cloud, const glm::mat3& rotationMatrix, const glm::vec3& translationVector, std::vector<Point_f>* result);
+	void TransformCloud(const std::vector<Point_f>& cloud, const glm::mat3& rotationMatrix, const glm::vec3& translationVector, const float& scale, std::vector<Point_f>* result);
 
 	// Transform point helpers
 	[[deprecated("Replaced by version with rotation matrix and translation vector")]]
@@ -50,7 +67,7 @@ namespace Common
 	[[deprecated("Replaced by version with rotation matrix and translation vector")]]
 	float GetMeanSquaredError(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const glm::mat4& matrix);
 	float GetMeanSquaredError(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const glm::mat3& rotationMatrix, const glm::vec3& translationVector);
-	float GetMeanSquaredError(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const std::vector<int>& correspondingIndexesBefore, const std::vector<int> correspondingIndexesAfter);
+	float GetMeanSquaredError(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const std::vector<int>& correspondingIndexesBefore, const std::vector<int>& correspondingIndexesAfter);
 	float GetMeanSquaredError(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter);
 
 	/// Gets ceneter of mass of the given cloud, useful when aligning cloud
@@ -84,18 +101,35 @@ namespace Common
 	/// \param parallel Determines parallel or sequential execution
 	CorrespondingPointsTuple GetCorrespondingPoints(const std::vector<Common::Point_f>& cloudBefore, const std::vector<Common::Point_f>& cloudAfter, float maxDistanceSquared, bool parallel);
 
-	/// Performs SVD optimization between cloudBefore and cloudAfter. Note that the clouds should be in corresponding order
+	/// Gets corresponding points between two clouds using prebuilt KD-tree of cloudAfter
+	/// \param cloudAfterIndex KD-tree built over cloudAfter, should be built once and reused between calls
+	CorrespondingPointsTuple GetCorrespondingPoints(const std::vector<Common::Point_f>& cloudBefore, const std::vector<Common::Point_f>& cloudAfter, const KdTree& cloudAfterIndex, float maxDistanceSquared, bool parallel);
+
+	/// Gets corresponding points between two clouds using prebuilt voxel grid of cloudAfter
+	/// \param cloudAfterGrid Voxel grid built over cloudAfter with cell size not smaller than sqrt(maxDistanceSquared)
+	CorrespondingPointsTuple GetCorrespondingPoints(const std::vector<Common::Point_f>& cloudBefore, const std::vector<Common::Point_f>& cloudAfter, const VoxelGrid& cloudAfterGrid, float maxDistanceSquared, bool parallel);
+
+	/// Fills correspondences between two clouds without allocating once the buffers have grown to the size of cloudBefore.
+	/// Overloads match GetCorrespondingPoints
+	/// \param correspondences Output buffers, reused between calls
+	void GetCorrespondingIndices(const std::vector<Common::Point_f>& cloudBefore, const std::vector<Common::Point_f>& cloudAfter, float maxDistanceSquared, bool parallel, CorrespondingIndices* correspondences);
+	void GetCorrespondingIndices(const std::vector<Common::Point_f>& cloudBefore, const std::vector<Common::Point_f>& cloudAfter, const KdTree& cloudAfterIndex, float maxDistanceSquared, bool parallel, CorrespondingIndices* correspondences);
+	void GetCorrespondingIndices(const std::vector<Common::Point_f>& cloudBefore, const std::vector<Common::Point_f>& cloudAfter, const VoxelGrid& cloudAfterGrid, float maxDistanceSquared, bool parallel, CorrespondingIndices* correspondences);
+
+	/// Finds rigid transformation between cloudBefore and cloudAfter in a single pass (see KabschAccumulator). Note that the clouds should be in corresponding order
 	/// \returns Rotation and translation pair
 	std::pair<glm::mat3, glm::vec3> LeastSquaresSVD(const std::vector<Common::Point_f>& cloudBefore, const std::vector<Common::Point_f>& cloudAfter);
 
+	/// Finds rigid transformation between pairs of points given by indexes, without copying the points
+	/// \param parallel Splits the pass between thread pool workers, result does not depend on thread count
+	std::pair<glm::mat3, glm::vec3> LeastSquaresSVD(const std::vector<Common::Point_f>& cloudBefore, const std::vector<Common::Point_f>& cloudAfter, const std::vector<int>& indexesBefore, const std::vector<int>& indexesAfter, bool parallel);
+
 	/// Creates random permutation vector with values in range [0, size) 
-	std::vector<int> GetRandomPermutationVector(int size);
+	std::vector<int> GetRandomPermutationVector(int size, RandomStream& random = GetDefaultRandomStream());
 
 	/// Creates permutation inverse to input parameter
 	std::vector<int> InversePermutation(const std::vector<int>& permutation);
 
-	void SetRandom();
-
 	/// Permutes input cloud with given permutation 
 	template<typename T>
 	std::vector<T> ApplyPermutation(const std::vector<T>& input, const std::vector<int>& permutation)
@@ -52,6 +52,7 @@ namespace Common
 			ParseTransformation(parsed);
 			ParseTransformationParameters(parsed);
 			ParseAdditionalParameters(parsed);
+			ParseCpdLevels(parsed);
 
 			ValidateConfiguration();
 		}
@@ -76,7 +77,8 @@ namespace Common
 		const std::map<std::string, ComputationMethod> mapping = {
 			{ "icp", ComputationMethod::Icp },
 			{ "nicp", ComputationMethod::NoniterativeIcp },
-			{ "cpd", ComputationMethod::Cpd }
+			{ "cpd", ComputationMethod::Cpd },
+			{ "nonrigid-cpd", ComputationMethod::NonRigidCpd }
 		};
 
 		const auto methodStr = method.value();
@@ -189,6 +191,36 @@ namespace Common
 		}
 	}
 
+	void ConfigParser::ParseCpdLevels(const nlohmann::json& parsed)
+	{
+		auto levelsIt = parsed.find("cpd-levels");
+		if (levelsIt == parsed.end())
+			return;
+
+		try
+		{
+			for (const auto& level : *levelsIt)
+			{
+				CpdLevel cpdLevel;
+				cpdLevel.VoxelSize = level["voxel-size"].get<float>();
+				cpdLevel.Iterations = level["iterations"].get<int>();
+				if (cpdLevel.VoxelSize <= 0.0f || cpdLevel.Iterations < 0)
+				{
+					printf("Parsing error: Cpd level voxel size has to be positive and iterations not negative\n");
+					correct = false;
+					return;
+				}
+
+				config.CpdLevels.push_back(cpdLevel);
+			}
+		}
+		catch (...)
+		{
+			printf("Parsing error: Error parsing cpd-levels parameter\n");
+			correct = false;
+		}
+	}
+
 	void ConfigParser::ParseAdditionalParameters(const nlohmann::json& parsed)
 	{
 		config.MaxIterations = ParseOptional<int>(parsed, "max-iterations");
@@ -205,6 +237,8 @@ namespace Common
 
 		config.NoiseAffectedPointsAfter = ParseOptional<float>(parsed, "noise-affected-points-after");
 
+		config.ThreadCount = ParseOptional<int>(parsed, "thread-count");
+
 		config.ShowVisualisation = ParseOptional(parsed, "show-visualisation", false);
 
 		config.MaxDistanceSquared = ParseOptional(parsed, "max-distance-squared", 1000.f);
@@ -219,7 +253,8 @@ namespace Common
 			const std::map<std::string, ApproximationType> mapping = {
 				{ "full", ApproximationType::Full },
 				{ "hybrid", ApproximationType::Hybrid },
-				{ "none", ApproximationType::None }
+				{ "none", ApproximationType::None },
+				{ "auto", ApproximationType::Auto }
 			};
 
 			const auto approximationString = approximationType.value();
@@ -241,6 +276,14 @@ namespace Common
 		
 		config.CpdTolerance = ParseOptional(parsed, "cpd-tolerance", 1e-3);
 
+		config.CpdSparsePMatrix = ParseOptional(parsed, "cpd-sparse-p-matrix", false);
+
+		config.CpdBeta = ParseOptional(parsed, "cpd-beta", 2.0f);
+
+		config.CpdLambda = ParseOptional(parsed, "cpd-lambda", 3.0f);
+
+		config.CpdKernelRank = ParseOptional(parsed, "cpd-kernel-rank", 100);
+
 		config.ConvergenceEpsilon = ParseOptional(parsed, "convergence-epsilon", 1e-3);
 
 		config.NoiseIntensityBefore = ParseOptional(parsed, "noise-intensity-before", 0.1f);
@@ -254,6 +297,28 @@ namespace Common
 		config.RatioOfFarField = ParseOptional(parsed, "fgt-ratio-of-far-field", 10.0f);
 
 		config.OrderOfTruncation = ParseOptional(parsed, "fgt-order-of-truncation", 8);
+
+		config.FgtErrorTolerance = ParseOptional<float>(parsed, "fgt-error-tolerance");
+
+		config.NearestNeighbourMethod = [this, &parsed]() {
+			auto nearestNeighbourMethod = ParseOptional<std::string>(parsed, "nearest-neighbour-search");
+			if (!nearestNeighbourMethod.has_value())
+				return NearestNeighbourMethod::KdTree;
+
+			const std::map<std::string, NearestNeighbourMethod> mapping = {
+				{ "brute-force", NearestNeighbourMethod::BruteForce },
+				{ "kd-tree", NearestNeighbourMethod::KdTree },
+				{ "voxel-grid", NearestNeighbourMethod::VoxelGrid }
+			};
+
+			const auto nearestNeighbourString = nearestNeighbourMethod.value();
+			if (auto result = mapping.find(nearestNeighbourString); result != mapping.end())
+				return result->second;
+			else
+				return NearestNeighbourMethod::KdTree;
+		}();
+
+		config.ThreadAffinity = ParseOptional(parsed, "thread-affinity", false);
 	}
 
 	void ConfigParser::ValidateConfiguration()
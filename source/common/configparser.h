@@ -22,6 +22,7 @@ namespace Common
 		void ParseTransformation(const nlohmann::json& parsed);
 		void ParseTransformationParameters(const nlohmann::json& parsed);
 		void ParseAdditionalParameters(const nlohmann::json& parsed);
+		void ParseCpdLevels(const nlohmann::json& parsed);
 
 		void ValidateConfiguration();
 
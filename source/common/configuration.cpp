@@ -12,6 +12,8 @@ void Common::Configuration::Print()
 			return "Cpd";
 		case ComputationMethod::NoniterativeIcp:
 			return "Non iterative icp";
+		case ComputationMethod::NonRigidCpd:
+			return "Non-rigid cpd";
 		default:
 			return "";
 		}
@@ -41,6 +43,22 @@ void Common::Configuration::Print()
 			return "None";
 		case ApproximationType::Hybrid:
 			return "Hybrid";
+		case ApproximationType::Auto:
+			return "Auto";
+		default:
+			return "";
+		}
+	}();
+
+	const auto nearestNeighbourString = [n = this->NearestNeighbourMethod]() {
+		switch (n)
+		{
+		case NearestNeighbourMethod::BruteForce:
+			return "Brute force";
+		case NearestNeighbourMethod::KdTree:
+			return "Kd-tree";
+		case NearestNeighbourMethod::VoxelGrid:
+			return "Voxel grid";
 		default:
 			return "";
 		}
@@ -97,18 +115,32 @@ void Common::Configuration::Print()
 		printf("Noise intensity after: %f\n", NoiseIntensityAfter);
 	}
 
+	if (ThreadCount.has_value())
+		printf("Thread count: %d\n", ThreadCount.value());
+
+	if (FgtErrorTolerance.has_value())
+		printf("Fgt error tolerance: %f\n", FgtErrorTolerance.value());
+
 	printf("Show visualisation: %s\n", std::to_string(ShowVisualisation).c_str());
 	printf("Max distance squared: %f\n", MaxDistanceSquared);
 	printf("Approximation type: %s\n", approximationString);
 	printf("Nicp batch size: %d\n", NicpBatchSize);
-	printf("Nicp iterations: %d\n", NicpIterations);
+	printf("Nicp iterations: %d (at most 4 on cpu)\n", NicpIterations);
 	printf("Nicp subcloud size: %d\n", NicpSubcloudSize);
 	printf("Cpd weight: %f\n", CpdWeight);
 	printf("Cpd const scale: %s\n", std::to_string(CpdConstScale).c_str());
 	printf("Cpd tolerance: %f\n", CpdTolerance);
+	printf("Cpd sparse P matrix: %s\n", std::to_string(CpdSparsePMatrix).c_str());
+	for (const auto& level : CpdLevels)
+		printf("Cpd level: voxel size %f, %d iterations\n", level.VoxelSize, level.Iterations);
+	printf("Cpd beta: %f\n", CpdBeta);
+	printf("Cpd lambda: %f\n", CpdLambda);
+	printf("Cpd kernel rank: %d\n", CpdKernelRank);
 	printf("Convergence epsilon: %f\n", ConvergenceEpsilon);
 	printf("Additional outliers before: %d\n", AdditionalOutliersBefore);
 	printf("Additional outliers after: %d\n", AdditionalOutliersAfter);
+	printf("Nearest neighbour search: %s\n", nearestNeighbourString);
+	printf("Thread affinity: %s\n", std::to_string(ThreadAffinity).c_str());
 
 	printf("===============================\n");
 }
@@ -4,6 +4,13 @@
 
 namespace Common
 {
+	/// Level of coarse-to-fine CPD, registers centroids of voxels before the full clouds
+	struct CpdLevel
+	{
+		float VoxelSize = 1.0f;
+		int Iterations = 0;
+	};
+
 	struct Configuration
 	{
 		//required parameters
@@ -22,17 +29,24 @@ namespace Common
 		std::optional<int> RandomSeed = std::nullopt;
 		std::optional<float> NoiseAffectedPointsBefore = std::nullopt;
 		std::optional<float> NoiseAffectedPointsAfter = std::nullopt;
+		std::optional<int> ThreadCount = std::nullopt; // hardware concurrency if not set
+		std::optional<float> FgtErrorTolerance = std::nullopt; // K, order of truncation and ratio of far field chosen for this error if set
 
 		//optional parameters with default values
 		bool ShowVisualisation = false;
 		float MaxDistanceSquared = 1000.f;
 		ApproximationType ApproximationType = ApproximationType::Hybrid;
 		int NicpBatchSize = 16;
-		int NicpIterations = 32;
+		int NicpIterations = 32; // gpu permutations, the cpu takes at most 4, one for each sign combination of principal axes
 		int NicpSubcloudSize = 1000;
 		float CpdWeight = .3f;
 		bool CpdConstScale = true;
 		float CpdTolerance = 1e-3f;
+		bool CpdSparsePMatrix = false;
+		std::vector<CpdLevel> CpdLevels; // coarsest first, full clouds are registered after the last level
+		float CpdBeta = 2.0f; // width of the displacement kernel of non-rigid CPD, for clouds normalised to unit variance
+		float CpdLambda = 3.0f; // weight of smoothness of the displacement of non-rigid CPD
+		int CpdKernelRank = 100; // eigenvalues of the displacement kernel kept by non-rigid CPD
 		float ConvergenceEpsilon = 1e-3f;
 		float NoiseIntensityBefore = 0.1f;
 		float NoiseIntensityAfter = 0.1f;
@@ -40,6 +54,8 @@ namespace Common
 		int AdditionalOutliersAfter = 0;
 		float RatioOfFarField = 10.0f;
 		int OrderOfTruncation = 8;
+		NearestNeighbourMethod NearestNeighbourMethod = NearestNeighbourMethod::KdTree;
+		bool ThreadAffinity = false;
 
 		void Print();
 	};
@@ -4,10 +4,35 @@
 #include "cpdutils.h"
 #include "fgt.h"
 #include "fgt_model.h"
+#include "gausskernel.h"
+#include "threadpool.h"
 
 using namespace Common;
 using namespace FastGaussTransform;
 
+namespace
+{
+	// Largest number of clusters considered by automatic FGT parameters
+	constexpr int MAX_AUTO_CLUSTERS = 512;
+	// Number of points of cloudAfter at which automatic FGT error is measured
+	constexpr int ERROR_SAMPLES = 16;
+	// Cost of one pair of points in the exact E-step in units of one term of the FGT expansion, measured with the AVX2 kernel
+	constexpr double DIRECT_PAIR_COST = 3.0;
+	// Cost of one candidate of the truncated E-step (gathered, not vectorized) in the same units
+	constexpr double TRUNCATED_CANDIDATE_COST = 12.0;
+	// Cost of the truncated E-step per point of both clouds, building the grid and looking up 27 cells around every target
+	constexpr double GRID_POINT_COST = 500.0;
+	// Number of points of cloudAfter at which candidate count of the truncated E-step is measured
+	constexpr int CANDIDATE_SAMPLES = 64;
+	// Randomised eigen decomposition of the kernel matrix samples this many more vectors than the rank and multiplies
+	// the samples by the matrix this many times more, so that eigenvectors of slowly decaying eigenvalues are accurate
+	constexpr int LOW_RANK_OVERSAMPLING = 10;
+	constexpr int LOW_RANK_POWER_ITERATIONS = 2;
+	constexpr unsigned int LOW_RANK_SEED = 0;
+	// Rows of the kernel matrix computed at once by the direct product
+	constexpr int KERNEL_BLOCK_ROWS = 32;
+}
+
 namespace CoherentPointDrift
 {
 	Eigen::VectorXf CalculatePt1(const std::vector<float>& Kt1, const float& ndi);
@@ -16,6 +41,92 @@ namespace CoherentPointDrift
 		const std::vector<float>& invDenomP,
 		const int& row);
 
+	float CalculateSigmaSquared(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter)
+	{
+		const auto get_mean = [](const std::vector<Point_f>& cloud) {
+			Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+			for (const auto& point : cloud)
+				sum += Eigen::Vector3d(point.x, point.y, point.z);
+			return Eigen::Vector3d(sum / static_cast<double>(cloud.size()));
+		};
+
+		// mean of |p - mean|^2, centered before squaring so that clouds far from origin do not lose precision
+		const auto get_variance = [](const std::vector<Point_f>& cloud, const Eigen::Vector3d& mean) {
+			double sum = 0.0;
+			for (const auto& point : cloud)
+				sum += (Eigen::Vector3d(point.x, point.y, point.z) - mean).squaredNorm();
+			return sum / static_cast<double>(cloud.size());
+		};
+
+		const Eigen::Vector3d meanBefore = get_mean(cloudBefore);
+		const Eigen::Vector3d meanAfter = get_mean(cloudAfter);
+
+		// 1/(NM) * sum over all pairs |x - y|^2 = var(x) + var(y) + |mean(x) - mean(y)|^2
+		const double meanSquaredDistance = get_variance(cloudBefore, meanBefore) + get_variance(cloudAfter, meanAfter) + (meanBefore - meanAfter).squaredNorm();
+		return static_cast<float>(meanSquaredDistance / DIMENSION);
+	}
+
+	float GetTruncationRadius(const float& sigmaSquared, const float& truncate)
+	{
+		return std::sqrt(-2.0f * sigmaSquared * std::max(std::log(truncate), MIN_EXP_ARGUMENT));
+	}
+
+	float EstimateCandidateCount(const VoxelGrid& grid, const std::vector<Point_f>& targets)
+	{
+		if (targets.empty())
+			return 0.0f;
+
+		const int samples = std::min(static_cast<int>(targets.size()), CANDIDATE_SAMPLES);
+		long long candidates = 0;
+		for (int i = 0; i < samples; i++)
+			candidates += grid.CountCandidates(targets[static_cast<long long>(targets.size()) * i / samples]);
+
+		return static_cast<float>(candidates) / samples;
+	}
+
+	EStepMethod ChooseEStepMethod(
+		const std::vector<Point_f>& cloudTransformed,
+		const std::vector<Point_f>& cloudAfter,
+		const float& sigmaSquared,
+		const float& errorTolerance,
+		VoxelGrid* grid,
+		FGTCache* cache,
+		FGTEStepParameters* fgtParameters)
+	{
+		const int N = cloudAfter.size();
+		const int M = cloudTransformed.size();
+
+		const double directCost = DIRECT_PAIR_COST * N * M;
+		// kernel values below the tolerance are dropped, only sources from cells around every target are visited
+		grid->Build(cloudTransformed, GetTruncationRadius(sigmaSquared, errorTolerance));
+		const double truncatedCost = GRID_POINT_COST * (N + M) + TRUNCATED_CANDIDATE_COST * N * EstimateCandidateCount(*grid, cloudAfter);
+
+		EStepMethod method = EStepMethod::Direct;
+		double cost = directCost;
+		if (truncatedCost < cost)
+		{
+			method = EStepMethod::Truncated;
+			cost = truncatedCost;
+		}
+
+		// parameters of P1 and PX come from the cached clustering of cloudAfter. Clustering cloudTransformed for the denominators
+		// has to be done every iteration, so it is skipped when FGT loses already with parameters of cloudAfter
+		const float hsigma = std::sqrt(2.0f * sigmaSquared);
+		const int maxK = std::min({ N, M, MAX_AUTO_CLUSTERS });
+		fgtParameters->probabilities = ChooseFGTParameters(cloudAfter, M, hsigma, errorTolerance, maxK, &cache->radiusClustering);
+		if (fgtParameters->probabilities.errorBound > errorTolerance || fgtParameters->probabilities.cost >= cost)
+			return method;
+
+		FGT_Clustering transformedClustering;
+		fgtParameters->denominators = ChooseFGTParameters(cloudTransformed, N, hsigma, errorTolerance, maxK, &transformedClustering);
+		// both parameter sets estimate cost of the whole E-step, each with its own clusters
+		const double fgtCost = 0.5 * (fgtParameters->denominators.cost + fgtParameters->probabilities.cost);
+		if (fgtParameters->denominators.errorBound <= errorTolerance && fgtCost < cost)
+			method = EStepMethod::FGT;
+
+		return method;
+	}
+
 	Probabilities ComputePMatrixWithFGT(
 		const std::vector<Point_f>& cloudTransformed,
 		const std::vector<Point_f>& cloudAfter,		
@@ -23,7 +134,10 @@ namespace CoherentPointDrift
 		const float& sigmaSquared,
 		const float& sigmaSquaredInit,
 		const float& ratioOfFarField,
-		const float& orderOfTruncation)
+		const float& orderOfTruncation,
+		const float& errorTolerance,
+		FGTCache* cache,
+		const FGTEStepParameters* chosenParameters)
 	{
 		const int N = cloudAfter.size();
 		const int M = cloudTransformed.size();
@@ -35,11 +149,32 @@ namespace CoherentPointDrift
 		int K_param = std::round(std::min({ (float)N, (float)M, 50.0f + sigmaSquaredInit / sigmaSquared }));
 		int p_param = orderOfTruncation; //Order of truncation (default p = 8)
 
+		FGTCache localCache;
+		if (cache == nullptr)
+			cache = &localCache;
+
+		//denominators are a transform of cloudTransformed and P1 and PX of cloudAfter, so each gets parameters for radii of its own clusters
+		FGTEStepParameters parameters = { { K_param, p_param, e_param, 0.0f, 0.0 }, { K_param, p_param, e_param, 0.0f, 0.0 } };
+		if (chosenParameters != nullptr)
+		{
+			parameters = *chosenParameters;
+		}
+		else if (errorTolerance > 0.0f)
+		{
+			const int maxK = std::min({ N, M, MAX_AUTO_CLUSTERS });
+			//cloudTransformed moves every iteration, so its clustering is not kept in the cache
+			FGT_Clustering transformedClustering;
+			parameters.denominators = ChooseFGTParameters(cloudTransformed, N, hsigma, errorTolerance, maxK, &transformedClustering);
+			parameters.probabilities = ChooseFGTParameters(cloudAfter, M, hsigma, errorTolerance, maxK, &cache->radiusClustering);
+		}
+		const FGT_Parameters& denominatorParameters = parameters.denominators;
+		const FGT_Parameters& probabilityParameters = parameters.probabilities;
+
 		FGT_Model fgt_model;
 
 		//compute pt1 and denom
-		fgt_model = ComputeFGTModel(cloudTransformed, std::vector<float>(M, 1.0f), hsigma, K_param, p_param);
-		auto Kt1 = ComputeFGTPredict(cloudAfter, fgt_model, hsigma, e_param, K_param, p_param);
+		fgt_model = ComputeFGTModel(cloudTransformed, std::vector<float>(M, 1.0f), hsigma, denominatorParameters.K, denominatorParameters.p);
+		auto Kt1 = ComputeFGTPredict(cloudAfter, fgt_model, hsigma, denominatorParameters.e, denominatorParameters.p);
 
 		const float ndi = (std::pow(2 * M_PI * sigmaSquared, (float)DIMENSION * 0.5f) * weight * M) / ((1 - weight) * N);
 
@@ -49,19 +184,34 @@ namespace CoherentPointDrift
 
 		Eigen::VectorXf pt1 = CalculatePt1(invDenomP, ndi);
 
-		//compute P1
-		fgt_model = ComputeFGTModel(cloudAfter, invDenomP, hsigma, K_param, p_param);
-		auto P1_vector = ComputeFGTPredict(cloudTransformed, fgt_model, hsigma, e_param, K_param, p_param);
-		Eigen::VectorXf p1 = GetVectorXFromPointsVector(P1_vector);
-
-		//compute PX
-		Eigen::MatrixXf px = Eigen::MatrixXf::Zero(cloudTransformed.size(), DIMENSION);
+		//compute P1 and PX with one model, weights: invDenomP and every coordinate of cloudAfter multiplied by invDenomP
+		std::vector<std::vector<float>> weights = { invDenomP };
 		for (int i = 0; i < DIMENSION; i++)
+			weights.push_back(CalculateWeightsForPX(cloudAfter, invDenomP, i));
+
+		//cloudAfter does not move, so its clustering is only extended when K grows
+		UpdateFGTClustering(cloudAfter, probabilityParameters.K, &cache->afterClustering);
+
+		fgt_model = ComputeFGTModel(cloudAfter, cache->afterClustering, weights, hsigma, probabilityParameters.p);
+		const Eigen::MatrixXf predicted = ComputeFGTMultiPredict(cloudTransformed, fgt_model, hsigma, probabilityParameters.e, probabilityParameters.p);
+		Eigen::VectorXf p1 = predicted.col(0);
+		Eigen::MatrixXf px = predicted.rightCols(DIMENSION);
+
+		if (errorTolerance > 0.0f)
 		{
-			fgt_model = ComputeFGTModel(cloudAfter, CalculateWeightsForPX(cloudAfter, invDenomP, i), hsigma, K_param, p_param);
-			auto result_vector = ComputeFGTPredict(cloudTransformed, fgt_model, hsigma, e_param, K_param, p_param);
-			Eigen::VectorXf result_eigen = GetVectorXFromPointsVector(result_vector);
-			px.col(i) = result_eigen;
+			//compare Kt1 with the exact sum at a few points, relative to total weight of sources like the bound
+			double sampledError = 0.0;
+			for (int sample = 0; sample < std::min(N, ERROR_SAMPLES); sample++)
+			{
+				const int n = sample * N / std::min(N, ERROR_SAMPLES);
+				double exact = 0.0;
+				for (const auto& point : cloudTransformed)
+					exact += std::exp(-(cloudAfter[n] - point).LengthSquared() / (hsigma * hsigma));
+				sampledError = std::max(sampledError, std::abs(exact - Kt1[n]) / M);
+			}
+			printf("fgt denominators K: %d, p: %d, e: %f, error bound: %g, sampled error: %g; probabilities K: %d, p: %d, e: %f, error bound: %g\n",
+				denominatorParameters.K, denominatorParameters.p, denominatorParameters.e, denominatorParameters.errorBound, sampledError,
+				probabilityParameters.K, probabilityParameters.p, probabilityParameters.e, probabilityParameters.errorBound);
 		}
 
 		//calculate error
@@ -93,4 +243,92 @@ namespace CoherentPointDrift
 		}
 		return result;
 	}
+
+	LowRankKernel ComputeLowRankKernel(
+		const std::vector<Point_f>& cloud,
+		const float& beta,
+		const int& rank,
+		const float& errorTolerance,
+		bool parallel)
+	{
+		const int M = cloud.size();
+		const int columns = std::min(M, rank + LOW_RANK_OVERSAMPLING);
+		const float hsigma = std::sqrt(2.0f) * beta;
+
+		FGT_Clustering radiusClustering;
+		const FGT_Parameters fgtParameters = ChooseFGTParameters(cloud, M, hsigma, errorTolerance, std::min(M, MAX_AUTO_CLUSTERS), &radiusClustering);
+		const bool useFGT = fgtParameters.errorBound <= errorTolerance;
+
+		FGT_Clustering clustering;
+		if (useFGT)
+			UpdateFGTClustering(cloud, fgtParameters.K, &clustering);
+
+		// G * vectors for every column of vectors
+		const auto multiply = [&](const Eigen::MatrixXf& vectors) {
+			if (useFGT)
+			{
+				std::vector<std::vector<float>> weights(vectors.cols());
+				for (int c = 0; c < vectors.cols(); c++)
+					weights[c] = std::vector<float>(vectors.col(c).data(), vectors.col(c).data() + M);
+
+				const FGT_Model model = ComputeFGTModel(cloud, clustering, weights, hsigma, fgtParameters.p);
+				return ComputeFGTMultiPredict(cloud, model, hsigma, fgtParameters.e, fgtParameters.p);
+			}
+
+			Eigen::MatrixXf result(M, vectors.cols());
+			const float multiplier = -1.0f / (hsigma * hsigma);
+			const int blockCount = (M + KERNEL_BLOCK_ROWS - 1) / KERNEL_BLOCK_ROWS;
+			const auto multiply_blocks = [&](int beginBlock, int endBlock) {
+				Eigen::MatrixXf kernel(KERNEL_BLOCK_ROWS, M);
+				for (int block = beginBlock; block < endBlock; block++)
+				{
+					const int begin = block * KERNEL_BLOCK_ROWS;
+					const int rows = std::min(KERNEL_BLOCK_ROWS, M - begin);
+					for (int j = 0; j < M; j++)
+						for (int r = 0; r < rows; r++)
+							kernel(r, j) = std::exp(multiplier * (cloud[begin + r] - cloud[j]).LengthSquared());
+
+					result.middleRows(begin, rows).noalias() = kernel.topRows(rows) * vectors;
+				}
+			};
+
+			if (parallel)
+				ThreadPool::GetInstance().ParallelFor(0, blockCount, multiply_blocks, 1);
+			else
+				multiply_blocks(0, blockCount);
+
+			return result;
+		};
+
+		const auto orthonormalize = [](const Eigen::MatrixXd& vectors) {
+			const Eigen::HouseholderQR<Eigen::MatrixXd> qr(vectors);
+			return Eigen::MatrixXd(qr.householderQ() * Eigen::MatrixXd::Identity(vectors.rows(), vectors.cols()));
+		};
+
+		std::mt19937 generator{ LOW_RANK_SEED };
+		std::normal_distribution<float> distribution;
+		Eigen::MatrixXf samples = Eigen::MatrixXf::NullaryExpr(M, columns, [&]() { return distribution(generator); });
+
+		// range of G is found from products with random vectors, every power iteration makes larger eigenvalues more dominant
+		samples = multiply(samples);
+		for (int i = 0; i < LOW_RANK_POWER_ITERATIONS; i++)
+			samples = multiply(orthonormalize(samples.cast<double>()).cast<float>());
+
+		// eigen decomposition of G projected onto the found range
+		const Eigen::MatrixXd basis = orthonormalize(samples.cast<double>());
+		const Eigen::MatrixXd product = multiply(basis.cast<float>()).cast<double>();
+		const Eigen::MatrixXd projected = basis.transpose() * product;
+		const Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(0.5 * (projected + projected.transpose()));
+
+		// eigenvalues of the solver are increasing
+		int kept = 0;
+		while (kept < std::min(rank, columns) && solver.eigenvalues()(columns - 1 - kept) > 0.0)
+			kept++;
+
+		LowRankKernel result;
+		result.eigenvalues = solver.eigenvalues().tail(kept).reverse().cast<float>();
+		result.eigenvectors = (basis * solver.eigenvectors().rightCols(kept).rowwise().reverse()).cast<float>();
+
+		return result;
+	}
 }
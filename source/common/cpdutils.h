@@ -2,6 +2,8 @@
 
 #include "_common.h"
 #include <Eigen/Dense>
+#include "fgt_model.h"
+#include "voxelgrid.h"
 
 namespace CoherentPointDrift
 {
@@ -17,6 +19,73 @@ namespace CoherentPointDrift
 		float error;
 	};
 
+	/// Error tolerance of ApproximationType::Auto when none is configured
+	constexpr float AUTO_ERROR_TOLERANCE = 1e-3f;
+
+	enum class EStepMethod
+	{
+		Direct,
+		Truncated,
+		FGT
+	};
+
+	/// FGT state kept between iterations of one registration
+	struct FGTCache
+	{
+		/// Clustering of cloudAfter used by the model, extended when K grows
+		FastGaussTransform::FGT_Clustering afterClustering;
+		/// Clustering of cloudAfter with the largest K considered by automatic parameters, source of cluster radii
+		FastGaussTransform::FGT_Clustering radiusClustering;
+	};
+
+	/// FGT parameters of both transforms of the E-step
+	struct FGTEStepParameters
+	{
+		/// Denominators, transform of cloudTransformed evaluated at cloudAfter
+		FastGaussTransform::FGT_Parameters denominators;
+		/// P1 and PX, transform of cloudAfter evaluated at cloudTransformed
+		FastGaussTransform::FGT_Parameters probabilities;
+	};
+
+	/// Low-rank approximation of the Gaussian kernel matrix G of a cloud, G ~ eigenvectors * diag(eigenvalues) * eigenvectors^T
+	struct LowRankKernel
+	{
+		/// Orthonormal columns (cloud size x rank)
+		Eigen::MatrixXf eigenvectors;
+		/// Positive, in decreasing order
+		Eigen::VectorXf eigenvalues;
+	};
+
+	/// Initial sigma squared, sum of squared distances between all pairs of points divided by (DIMENSION * N * M).
+	/// Computed in O(N + M) as sum of both cloud variances and squared distance between their means, in double precision
+	float CalculateSigmaSquared(const std::vector<Common::Point_f>& cloudBefore, const std::vector<Common::Point_f>& cloudAfter);
+
+	/// Distance beyond which Gaussian kernel values are smaller than truncate (relative to the kernel maximum)
+	float GetTruncationRadius(const float& sigmaSquared, const float& truncate);
+
+	/// Mean number of candidates returned by the grid for a few evenly spaced points of targets
+	float EstimateCandidateCount(const Common::VoxelGrid& grid, const std::vector<Common::Point_f>& targets);
+
+	/// Estimates costs of the exact, truncated and FGT E-steps for current sigma squared.
+	/// \param grid Storage for the grid of cloudTransformed, which measures how many sources the truncated E-step would visit.
+	/// Built for truncation at errorTolerance, so the truncated E-step can use it
+	/// \param fgtParameters Output for parameters of the FGT E-step, to be passed to ComputePMatrixWithFGT. Complete only when FGT is chosen
+	/// \returns the cheapest one with error relative to total weight not exceeding errorTolerance, exact E-step when costs are equal
+	EStepMethod ChooseEStepMethod(
+		const std::vector<Common::Point_f>& cloudTransformed,
+		const std::vector<Common::Point_f>& cloudAfter,
+		const float& sigmaSquared,
+		const float& errorTolerance,
+		Common::VoxelGrid* grid,
+		FGTCache* cache,
+		FGTEStepParameters* fgtParameters);
+
+	/// \param errorTolerance If positive, K, order of truncation and ratio of far field are chosen every call for this error
+	/// relative to total weight, separately for both transforms from clustering of their own sources.
+	/// Chosen parameters, error bound and error measured at a few points are printed.
+	/// Otherwise ratioOfFarField and orderOfTruncation are used
+	/// \param cache State kept between iterations of one registration, computed for this call only when nullptr
+	/// \param chosenParameters Parameters for errorTolerance from ChooseEStepMethod, chosen by this call when nullptr
 	Probabilities ComputePMatrixWithFGT(
 		const std::vector<Common::Point_f>& cloudTransformed,
 		const std::vector<Common::Point_f>& cloudAfter,
@@ -24,5 +93,19 @@ namespace CoherentPointDrift
 		const float& sigmaSquared,
 		const float& sigmaSquaredInit,
 		const float& ratioOfFarField,
-		const float& orderOfTruncation);
+		const float& orderOfTruncation,
+		const float& errorTolerance,
+		FGTCache* cache = nullptr,
+		const FGTEStepParameters* chosenParameters = nullptr);
+
+	/// Largest eigenvalues and eigenvectors of G_ij = exp(-|y_i - y_j|^2 / (2 * beta^2)) by randomised subspace iteration (Halko et al.),
+	/// G is never formed. Products of G with blocks of vectors use FGT when its error bound relative to total weight does not exceed
+	/// errorTolerance, otherwise kernel values are computed directly for every pair of points
+	/// \param rank Number of eigenvalues, fewer when the cloud is smaller or the remaining ones are not positive
+	LowRankKernel ComputeLowRankKernel(
+		const std::vector<Common::Point_f>& cloud,
+		const float& beta,
+		const int& rank,
+		const float& errorTolerance,
+		bool parallel);
 }
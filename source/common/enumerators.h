@@ -6,7 +6,9 @@ namespace Common
 	{
 		Icp,
 		NoniterativeIcp,
-		Cpd
+		Cpd,
+		// Non-rigid CPD, moves every point by a smooth displacement field
+		NonRigidCpd
 	};
 
 	enum class ExecutionPolicy
@@ -19,6 +21,15 @@ namespace Common
 	{
 		None,
 		Full,
-		Hybrid
+		Hybrid,
+		// CPD picks the cheapest E-step meeting error tolerance every iteration, other methods compute errors exactly
+		Auto
+	};
+
+	enum class NearestNeighbourMethod
+	{
+		BruteForce,
+		KdTree,
+		VoxelGrid
 	};
 }
@@ -29,56 +29,82 @@
 	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+
+#include <array>
+#include <numeric>
+#include <utility>
+
 #include "fgt.h"
 #include "fgt_model.h"
+#include "fgtmonomials.h"
+#include "threadpool.h"
+#include "voxelgrid.h"
 
 using namespace Common;
 
+namespace
+{
+	// Distances are updated in fixed chunks, so that the selected centers do not depend on the number of threads
+	constexpr int CLUSTERING_CHUNKS = 64;
+	// Smaller clouds are clustered on the calling thread
+	constexpr int MIN_PARALLEL_CLUSTERING_SIZE = 8192;
+
+	// Automatic parameters keep the order among unrolled expansions and add clusters instead
+	constexpr int MAX_AUTO_ORDER = FastGaussTransform::MAX_FIXED_ORDER;
+
+	// Costs of testing a cluster from grid cells around a target and of evaluating exponent at a near cluster,
+	// in units of one term of the expansion, measured on bunny and bird
+	constexpr double CANDIDATE_COST = 10.0;
+	constexpr double CLUSTER_VISIT_COST = 40.0;
+}
+
 namespace FastGaussTransform
 {
-	void KCenter(
+	int AddCenter(
 		const std::vector<Point_f>& cloud,
-		const int& K_param,
-		std::vector<Point_f>* xc,
-		std::vector<int>* indx);
+		const int& clusterIndex,
+		FGT_Clustering* clustering);
 
-	void ComputeC_k(const int& p_param, std::vector<float>* C_k);
+	double TruncationErrorBound(const double& rx, const double& ry, const double& h, const int& p_param);
 
-	void ComputeA_k(
+	FGT_Model ComputeFGTModel(
 		const std::vector<Point_f>& cloud,
 		const std::vector<float>& weights,
-		const std::vector<Point_f>& xc,
-		const std::vector<float>& C_k,
-		const std::vector<int>& indx,
 		const float& sigma,
 		const int& K_param,
-		const int& p_param,
-		const int& pd,
-		Eigen::MatrixXf* A_k);
-
-	int nchoosek(const int& n, int k);
+		const int& p_param)
+	{
+		return ComputeFGTModel(cloud, std::vector<std::vector<float>>{ weights }, sigma, K_param, p_param);
+	}
 
 	FGT_Model ComputeFGTModel(
 		const std::vector<Point_f>& cloud,
-		const std::vector<float>& weights,
+		const std::vector<std::vector<float>>& weights,
 		const float& sigma,
 		const int& K_param,
 		const int& p_param)
 	{
-		const int Nx = cloud.size();
-		const int pd = nchoosek(p_param + DIMENSION - 1, DIMENSION);
+		FGT_Clustering clustering;
+		UpdateFGTClustering(cloud, K_param, &clustering);
+		return ComputeFGTModel(cloud, clustering, weights, sigma, p_param);
+	}
 
-		auto xc = std::vector<Point_f>(K_param);
-		auto indx = std::vector<int>(Nx);
-		auto C_k = std::vector<float>(pd);
+	FGT_Model ComputeFGTModel(
+		const std::vector<Point_f>& cloud,
+		const FGT_Clustering& clustering,
+		const std::vector<std::vector<float>>& weights,
+		const float& sigma,
+		const int& p_param)
+	{
+		const int pd = nchoosek(p_param + DIMENSION - 1, DIMENSION);
 
-		Eigen::MatrixXf A_k = Eigen::ArrayXXf::Zero(pd, K_param);
+		Eigen::MatrixXf A_k = Eigen::ArrayXXf::Zero(pd * weights.size(), clustering.K);
 
-		KCenter(cloud, K_param, &xc, &indx);
-		ComputeC_k(p_param, &C_k);
-		ComputeA_k(cloud, weights, xc, C_k, indx, sigma, K_param, p_param, pd, &A_k);
+		DispatchOrder(p_param, [&](const auto& monomials) {
+			ComputeA_k(monomials, cloud, weights, clustering.xc, clustering.indx, sigma, clustering.K, &A_k);
+		});
 
-		return { xc, A_k };
+		return { clustering.xc, A_k };
 	}
 
 	std::vector<float> ComputeFGTPredict(
@@ -86,124 +112,189 @@ namespace FastGaussTransform
 		const FGT_Model& fgt_model,
 		const float& sigma,
 		const float& e_param,
-		const int& K_param,
 		const int& p_param)
 	{
-		const int Ny = cloud.size();
-		const int pd = fgt_model.Ak.rows();
-		const float invertedSigma = 1.0f / sigma;
-		Point_f dy = Point_f::Zero();
-		int k, t, tail, head, ind;
-
-		auto prods = std::vector<float>(pd);
-		auto heads = std::vector<int>(DIMENSION + 1);
-		auto v = std::vector<float>(Ny);
+		const Eigen::MatrixXf result = ComputeFGTMultiPredict(cloud, fgt_model, sigma, e_param, p_param);
+		return std::vector<float>(result.data(), result.data() + result.rows());
+	}
 
-		heads[DIMENSION] = std::numeric_limits<int>::max();
+	Eigen::MatrixXf ComputeFGTMultiPredict(
+		const std::vector<Common::Point_f>& cloud,
+		const FGT_Model& fgt_model,
+		const float& sigma,
+		const float& e_param,
+		const int& p_param)
+	{
+		const int pd = nchoosek(p_param + DIMENSION - 1, DIMENSION);
+		Eigen::MatrixXf v = Eigen::MatrixXf::Zero(cloud.size(), fgt_model.Ak.rows() / pd);
 
-		for (int m = 0; m < Ny; m++)
-		{
-			float cell_sum = 0.0;
-			for (int kn = 0; kn < K_param; kn++)
-			{
-				ind = kn * pd;
-				for (int i = 0; i < DIMENSION; i++)
-				{
-					heads[i] = 0;
-				}
+		DispatchOrder(p_param, [&](const auto& monomials) {
+			ComputeFGTMultiPredict(monomials, cloud, fgt_model, sigma, e_param, &v);
+		});
 
-				dy = cloud[m] - fgt_model.xc[kn];
-				dy *= invertedSigma;
-				const float sum = dy.LengthSquared();
+		return v;
+	}
 
-				if (sum > e_param) continue; //skip to next kn
+	FGT_Parameters ChooseFGTParameters(
+		const std::vector<Point_f>& sources,
+		const int& targetCount,
+		const float& sigma,
+		const float& tolerance,
+		const int& maxK,
+		FGT_Clustering* clustering)
+	{
+		if (clustering->K < maxK)
+			UpdateFGTClustering(sources, maxK, clustering);
 
-				prods[0] = std::exp(-sum);
+		// half of the tolerance is left for skipped clusters, exp(-cutoff^2 / sigma^2) = tolerance / 2
+		const double cutoffError = 0.5 * tolerance;
+		const double cutoff = sigma * std::sqrt(std::log(1.0 / cutoffError));
+		const double pointCount = sources.size() + targetCount;
 
-				for (k = 1, t = 1, tail = 1; k < p_param; k++, tail = t)
-				{
-					for (int i = 0; i < DIMENSION; i++)
-					{
-						head = heads[i];
-						heads[i] = t;
-						const float val = dy[i];
-						for (int j = head; j < tail; j++, t++)
-						{
-							prods[t] = val * prods[j];
-						}
-					}
-				}
+		FGT_Parameters best = { maxK, MAX_AUTO_ORDER, 0.0f, std::numeric_limits<float>::max(), std::numeric_limits<double>::max() };
+		double bestCost = std::numeric_limits<double>::max();
 
-				for (int i = 0; i < pd; i++)
-				{
-					cell_sum += fgt_model.Ak.data()[i + ind] * prods[i];
-				}
+		for (int K = 1; K <= maxK; K++)
+		{
+			const double rx = clustering->radii[K - 1];
+			const double ry = rx + cutoff;
+
+			int p = 1;
+			double bound = TruncationErrorBound(rx, ry, sigma, p);
+			while (bound > cutoffError && p < MAX_AUTO_ORDER)
+				bound = TruncationErrorBound(rx, ry, sigma, ++p);
+
+			// clusters are about rx apart and scanned points lie on surfaces, so a target sees about (ry / rx + 1)^2 of them
+			// within the cutoff and about three times more in the grid cells around it
+			const double nearClusters = std::min<double>(K, std::pow(ry / rx + 1.0, 2));
+			const double candidates = std::min<double>(K, 3.0 * nearClusters);
+			const int pd = nchoosek(p + DIMENSION - 1, DIMENSION);
+			// clustering both clouds, building models, and testing clusters and evaluating expansions at every target
+			const double cost = pointCount * (K + pd + CANDIDATE_COST * candidates + nearClusters * (CLUSTER_VISIT_COST + pd));
+			const bool feasible = bound <= cutoffError;
+
+			if ((feasible && cost < bestCost) || (K == maxK && bestCost == std::numeric_limits<double>::max()))
+			{
+				bestCost = feasible ? cost : bestCost;
+				best = { K, p, static_cast<float>(ry * ry / (sigma * sigma)), static_cast<float>(bound + cutoffError), cost };
 			}
-			v[m] = cell_sum;
 		}
-		return v;
+
+		return best;
+	}
+
+	// Bound of the error of expansion truncated after order p_param, relative to total weight,
+	// for sources not further than rx from the center and targets not further than ry
+	double TruncationErrorBound(const double& rx, const double& ry, const double& h, const int& p_param)
+	{
+		const double b = std::min((rx + std::sqrt(rx * rx + 2.0 * p_param * h * h)) / 2.0, ry);
+		const double c = rx - b;
+
+		// 2^p / p! * (rx * b / h^2)^p
+		double bound = 1.0;
+		for (int i = 1; i <= p_param; i++)
+			bound *= 2.0 * rx * b / (h * h * i);
+
+		return bound * std::exp(-c * c / (h * h));
 	}
 
-	void KCenter(
+	void UpdateFGTClustering(
 		const std::vector<Point_f>& cloud,
 		const int& K_param,
-		std::vector<Point_f>* xc,
-		std::vector<int>* indx)
+		FGT_Clustering* clustering)
 	{
 		const int Nx = cloud.size();
-		//auto indxc = std::vector<int>(K_param);
-		auto xboxsz = std::vector<int>(K_param);
-		auto dist_C = std::vector<float>(Nx);
-		int center_ind = 1;
-		//int indxc_index = 0;
+		if (clustering->K == K_param && clustering->indx.size() == static_cast<size_t>(Nx))
+			return;
 
-		//randomly pick one node as the first center.
-		//srand((unsigned)time(NULL));
-		//ind = rand() % Nx;
+		// Greedy selection can only be continued, fewer clusters need selection from the start
+		if (clustering->centers.empty() || clustering->centers.size() > static_cast<size_t>(K_param) || clustering->indx.size() != static_cast<size_t>(Nx))
+		{
+			clustering->centers.clear();
+			clustering->indx.assign(Nx, 0);
+			clustering->dist_C.assign(Nx, std::numeric_limits<float>::max());
+			clustering->radii.clear();
+			// first center is fixed, so that clustering is reproducible
+			clustering->nextCenter = std::min(1, Nx - 1);
+		}
+
+		clustering->centers.reserve(K_param);
+		clustering->radii.reserve(K_param);
+		while (clustering->centers.size() < static_cast<size_t>(K_param))
+		{
+			clustering->centers.push_back(clustering->nextCenter);
+			clustering->nextCenter = AddCenter(cloud, clustering->centers.size() - 1, clustering);
+			clustering->radii.push_back(std::sqrt(clustering->dist_C[clustering->nextCenter]));
+		}
 
-		//indxc[indxc_index++] = center_ind;
+		auto xboxsz = std::vector<int>(K_param, 0);
+		clustering->xc.assign(K_param, Point_f::Zero());
+		clustering->K = K_param;
 
 		for (int i = 0; i < Nx; i++)
 		{
-			const Point_f diff = cloud[i] - cloud[center_ind];
-			dist_C[i] = diff.LengthSquared();
-			(*indx)[i] = 0;
+			xboxsz[clustering->indx[i]]++;
+			clustering->xc[clustering->indx[i]] += cloud[i];
 		}
 
-		for (int i = 1; i < K_param; i++)
+		for (int i = 0; i < K_param; i++)
 		{
-			const auto furthestPoint = std::max_element(dist_C.begin(), dist_C.end());
-			center_ind = std::distance(dist_C.begin(), furthestPoint);
-			//indxc[indxc_index++] = center_ind;
-			for (int j = 0; j < Nx; j++)
+			clustering->xc[i] *= 1.0f / (float)xboxsz[i];
+		}
+	}
+
+	// Assigns points closer to the new center than to their current one and returns the farthest point from all centers
+	int AddCenter(
+		const std::vector<Point_f>& cloud,
+		const int& clusterIndex,
+		FGT_Clustering* clustering)
+	{
+		const int Nx = cloud.size();
+		const Point_f center = cloud[clustering->centers[clusterIndex]];
+		const int chunkLength = (Nx + CLUSTERING_CHUNKS - 1) / CLUSTERING_CHUNKS;
+		auto& dist_C = clustering->dist_C;
+		auto& indx = clustering->indx;
+
+		// farthest point of every chunk, -1 for empty chunks
+		std::array<int, CLUSTERING_CHUNKS> farthest;
+
+		const auto update_chunks = [&](int beginChunk, int endChunk) {
+			for (int chunk = beginChunk; chunk < endChunk; chunk++)
 			{
-				const Point_f diff = cloud[j] - cloud[center_ind];
-				float dist = diff.LengthSquared();
+				const int begin = std::min(Nx, chunk * chunkLength);
+				const int end = std::min(Nx, begin + chunkLength);
+				int farthestIndex = begin < end ? begin : -1;
 
-				if (dist < dist_C[j])
+				for (int j = begin; j < end; j++)
 				{
-					dist_C[j] = dist;
-					(*indx)[j] = i;
+					const Point_f diff = cloud[j] - center;
+					const float dist = diff.LengthSquared();
+
+					if (dist < dist_C[j])
+					{
+						dist_C[j] = dist;
+						indx[j] = clusterIndex;
+					}
+					if (dist_C[j] > dist_C[farthestIndex])
+						farthestIndex = j;
 				}
+				farthest[chunk] = farthestIndex;
 			}
-		}
-
-		for (int i = 0; i < K_param; i++)
-		{
-			xboxsz[i] = 0;
-			(*xc)[i] = Point_f::Zero();
-		}
+		};
 
-		for (int i = 0; i < Nx; i++)
-		{
-			xboxsz[(*indx)[i]]++;
-			(*xc)[(*indx)[i]] += cloud[i];
-		}
+		if (Nx >= MIN_PARALLEL_CLUSTERING_SIZE)
+			ThreadPool::GetInstance().ParallelFor(0, CLUSTERING_CHUNKS, update_chunks, 1);
+		else
+			update_chunks(0, CLUSTERING_CHUNKS);
 
-		for (int i = 0; i < K_param; i++)
+		// chunks are merged in order and only strictly farther points win, so ties go to the lowest index like in std::max_element
+		int result = farthest[0];
+		for (int chunk = 1; chunk < CLUSTERING_CHUNKS; chunk++)
 		{
-			(*xc)[i] *= 1.0f / (float)xboxsz[i];
+			if (farthest[chunk] >= 0 && dist_C[farthest[chunk]] > dist_C[result])
+				result = farthest[chunk];
 		}
+		return result;
 	}
 
 	void ComputeC_k(const int& p_param, std::vector<float>* C_k)
@@ -237,87 +328,4 @@ namespace FastGaussTransform
 			}
 		}
 	}
-
-	void ComputeA_k(
-		const std::vector<Point_f>& cloud,
-		const std::vector<float>& weights,
-		const std::vector<Point_f>& xc,
-		const std::vector<float>& C_k,
-		const std::vector<int>& indx,
-		const float& sigma,
-		const int& K_param,
-		const int& p_param,
-		const int& pd,
-		Eigen::MatrixXf* A_k)
-	{
-		const int Nx = cloud.size();
-		const float invertedSigma = 1.0f / sigma;
-		Point_f dx = Point_f::Zero();
-		int k, t, tail, head;
-
-		auto prods = std::vector<float>(pd);
-		auto heads = std::vector<int>(DIMENSION + 1);
-
-		heads[DIMENSION] = std::numeric_limits<int>::max();
-
-		for (int n = 0; n < Nx; n++)
-		{
-			dx = cloud[n] - xc[indx[n]];
-			dx *= invertedSigma;
-
-			prods[0] = std::exp(-dx.LengthSquared());
-
-			for (int i = 0; i < DIMENSION; i++)
-			{
-				heads[i] = 0;
-			}
-
-			for (k = 1, t = 1, tail = 1; k < p_param; k++, tail = t)
-			{
-				for (int i = 0; i < DIMENSION; i++)
-				{
-					head = heads[i];
-					heads[i] = t;
-					float val = dx[i];
-
-					for (int j = head; j < tail; j++, t++)
-					{
-						prods[t] = val * prods[j];
-					}
-				}
-			}
-
-			for (int i = 0; i < pd; i++)
-			{
-				(*A_k)(i, indx[n]) += weights[n] * prods[i];
-			}
-		}
-
-		for (int k = 0; k < K_param; k++)
-		{
-			for (int i = 0; i < pd; i++)
-			{
-				(*A_k)(i, k) *= C_k[i];
-			}
-		}
-	}
-
-	int nchoosek(const int& n, int k)
-	{
-		int n_k = n - k;
-		int nchsk = 1;
-		if (k < n_k)
-		{
-			k = n_k;
-			n_k = n - k;
-		}
-
-		for (int i = 1; i <= n_k; i++)
-		{
-			nchsk *= (++k);
-			nchsk /= i;
-		}
-
-		return nchsk;
-	}
 }
@@ -6,6 +6,16 @@
 namespace FastGaussTransform
 {
 	struct FGT_Model;
+	struct FGT_Clustering;
+	struct FGT_Parameters;
+
+	/// Clusters cloud into K_param clusters. Centers are selected in the same order for every K,
+	/// so clustering computed earlier for smaller K is extended instead of computed from scratch.
+	/// Clustering must not be reused for another cloud
+	void UpdateFGTClustering(
+		const std::vector<Common::Point_f>& cloud,
+		const int& K_param,
+		FGT_Clustering* clustering);
 
 	FGT_Model ComputeFGTModel(
 		const std::vector<Common::Point_f>& cloud,
@@ -14,11 +24,47 @@ namespace FastGaussTransform
 		const int& K_param,
 		const int& p_param);
 
+	/// Builds one model for several weight vectors, clustering and monomial expansion of the cloud are computed once
+	FGT_Model ComputeFGTModel(
+		const std::vector<Common::Point_f>& cloud,
+		const std::vector<std::vector<float>>& weights,
+		const float& sigma,
+		const int& K_param,
+		const int& p_param);
+
+	/// Chooses K, order of truncation and cutoff with the lowest estimated cost, for which bound of the error relative to total weight
+	/// (truncation of the expansion and skipping far clusters, as in the improved FGT of Raykar et al.) does not exceed tolerance.
+	/// Cluster radii are taken from clustering of sources, extended up to maxK clusters
+	FGT_Parameters ChooseFGTParameters(
+		const std::vector<Common::Point_f>& sources,
+		const int& targetCount,
+		const float& sigma,
+		const float& tolerance,
+		const int& maxK,
+		FGT_Clustering* clustering);
+
+	/// Builds model of several weight vectors with clustering of the cloud computed by UpdateFGTClustering
+	FGT_Model ComputeFGTModel(
+		const std::vector<Common::Point_f>& cloud,
+		const FGT_Clustering& clustering,
+		const std::vector<std::vector<float>>& weights,
+		const float& sigma,
+		const int& p_param);
+
+	/// Evaluates model at every point of the cloud, sums over all centers of the model
 	std::vector<float> ComputeFGTPredict(
 		const std::vector<Common::Point_f>& cloud,
 		const FGT_Model& fgt_model,
 		const float& sigma,
 		const float& e_param,
-		const int& K_param,
+		const int& p_param);
+
+	/// Evaluates model of several weight vectors in one pass
+	/// \returns Matrix (cloud size x W), column w holds the transform with w-th weights
+	Eigen::MatrixXf ComputeFGTMultiPredict(
+		const std::vector<Common::Point_f>& cloud,
+		const FGT_Model& fgt_model,
+		const float& sigma,
+		const float& e_param,
 		const int& p_param);
 }
@@ -9,6 +9,40 @@ namespace FastGaussTransform
 		// The K center points of the training set (d x K)
 		std::vector<Common::Point_f> xc;
 		// Polynomial coefficient (pd x K), where pd = nchoosek(p + d - 1 , d)
+		// Model of W weight vectors stacks their coefficients (pd * W x K), rows [w * pd, (w + 1) * pd) belong to w-th weights
 		Eigen::MatrixXf Ak;
 	};
+
+	/// Greedy farthest point clustering of a cloud. Depends only on the cloud and K,
+	/// so it is kept between models built for a cloud that does not move
+	struct FGT_Clustering
+	{
+		// Number of clusters
+		int K = 0;
+		// Mean of every cluster (d x K)
+		std::vector<Common::Point_f> xc;
+		// Cluster of every point
+		std::vector<int> indx;
+		// Points chosen as centers, in order of selection
+		std::vector<int> centers;
+		// Squared distance of every point to its center
+		std::vector<float> dist_C;
+		// Largest distance of a point to its center, radii[k - 1] for k clusters
+		std::vector<float> radii;
+		// Point which becomes the next center when the clustering is extended
+		int nextCenter = 0;
+	};
+
+	/// Parameters of one transform chosen for an error tolerance
+	struct FGT_Parameters
+	{
+		int K;
+		int p;
+		// Ratio of far field, squared cutoff distance divided by squared sigma
+		float e;
+		// Bound of the error relative to total weight of sources
+		float errorBound;
+		// Estimated cost of both transforms of the E-step, in units of one term of the expansion
+		double cost;
+	};
 }
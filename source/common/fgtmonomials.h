@@ -0,0 +1,304 @@
+#pragma once
+
+#include <array>
+#include <numeric>
+#include <utility>
+
+#include "fgt_model.h"
+#include "threadpool.h"
+#include "voxelgrid.h"
+
+// Internal to the fast Gauss transform. Monomial expansions and the model and prediction templates are shared
+// with the benchmark of unrolled expansions in the test sources
+namespace FastGaussTransform
+{
+	// Orders of truncation with expansion unrolled at compile time, other orders use generic expansion
+	constexpr int MIN_FIXED_ORDER = 2;
+	constexpr int MAX_FIXED_ORDER = 12;
+
+	void ComputeC_k(const int& p_param, std::vector<float>* C_k);
+
+	constexpr int nchoosek(int n, int k)
+	{
+		int n_k = n - k;
+		int nchsk = 1;
+		if (k < n_k)
+		{
+			k = n_k;
+			n_k = n - k;
+		}
+
+		for (int i = 1; i <= n_k; i++)
+		{
+			nchsk *= (++k);
+			nchsk /= i;
+		}
+
+		return nchsk;
+	}
+
+	/// Monomials of degree lower than P in the order used by the expansion, prods[t] = d[dimension[t]] * prods[source[t]],
+	/// and their coefficients C_k
+	template<int P>
+	struct MonomialTable
+	{
+		static constexpr int COUNT = nchoosek(P + Common::DIMENSION - 1, Common::DIMENSION);
+
+		std::array<int, COUNT> source{};
+		std::array<int, COUNT> dimension{};
+		std::array<float, COUNT> C_k{};
+	};
+
+	// Same walk over monomials as ComputeC_k, evaluated by the compiler
+	template<int P>
+	constexpr MonomialTable<P> MakeMonomialTable()
+	{
+		MonomialTable<P> table;
+		std::array<int, MonomialTable<P>::COUNT> cinds{};
+		std::array<int, Common::DIMENSION + 1> heads{};
+
+		heads[Common::DIMENSION] = std::numeric_limits<int>::max();
+		table.C_k[0] = 1.0f;
+
+		int k = 1, t = 1, tail = 1;
+		for (; k < P; k++, tail = t)
+		{
+			for (int i = 0; i < Common::DIMENSION; i++)
+			{
+				const int head = heads[i];
+				heads[i] = t;
+
+				for (int j = head; j < tail; j++, t++)
+				{
+					table.source[t] = j;
+					table.dimension[t] = i;
+					cinds[t] = (j < heads[i + 1]) ? cinds[j] + 1 : 1;
+					table.C_k[t] = 2.0 * table.C_k[j];
+					table.C_k[t] = table.C_k[t] / (double)cinds[t];
+				}
+			}
+		}
+
+		return table;
+	}
+
+	/// Expansion of order P, unrolled at compile time
+	template<int P>
+	class FixedOrderMonomials
+	{
+	public:
+		static constexpr int COUNT = MonomialTable<P>::COUNT;
+
+		constexpr int GetCount() const { return COUNT; }
+		float GetCoefficient(int i) const { return TABLE.C_k[i]; }
+
+		/// Fills prods[1, COUNT), prods[0] has to be set by the caller
+		void Compute(const Common::Point_f& d, float* prods) const
+		{
+			// copied, so that stores to prods do not force reloading coordinates
+			const std::array<float, Common::DIMENSION> values = { d.x, d.y, d.z };
+			ComputeUnrolled(values, prods, std::make_index_sequence<COUNT - 1>());
+		}
+
+		/// Sum of coefficients[i] * prods[i], accumulated in independent lanes so that it is vectorised
+		float Dot(const float* coefficients, const float* prods) const
+		{
+			std::array<float, DOT_LANES> lanes{};
+			for (int i = 0; i + DOT_LANES <= COUNT; i += DOT_LANES)
+			{
+				for (int lane = 0; lane < DOT_LANES; lane++)
+					lanes[lane] += coefficients[i + lane] * prods[i + lane];
+			}
+			for (int i = COUNT - COUNT % DOT_LANES; i < COUNT; i++)
+				lanes[0] += coefficients[i] * prods[i];
+
+			return std::accumulate(lanes.begin(), lanes.end(), 0.0f);
+		}
+
+	private:
+		static constexpr int DOT_LANES = 8;
+
+		template<size_t... I>
+		static void ComputeUnrolled(const std::array<float, Common::DIMENSION>& values, float* prods, std::index_sequence<I...>)
+		{
+			((prods[I + 1] = values[TABLE.dimension[I + 1]] * prods[TABLE.source[I + 1]]), ...);
+		}
+
+		static constexpr MonomialTable<P> TABLE = MakeMonomialTable<P>();
+	};
+
+	/// Expansion of any order, walks monomials at runtime
+	class GenericMonomials
+	{
+	public:
+		explicit GenericMonomials(const int& p_param)
+			: p(p_param), count(nchoosek(p_param + Common::DIMENSION - 1, Common::DIMENSION)), C_k(count)
+		{
+			ComputeC_k(p, &C_k);
+		}
+
+		int GetCount() const { return count; }
+		float GetCoefficient(int i) const { return C_k[i]; }
+
+		/// Fills prods[1, count), prods[0] has to be set by the caller
+		void Compute(const Common::Point_f& d, float* prods) const
+		{
+			std::array<int, Common::DIMENSION + 1> heads{};
+			heads[Common::DIMENSION] = std::numeric_limits<int>::max();
+
+			int k, t, tail, head;
+			for (k = 1, t = 1, tail = 1; k < p; k++, tail = t)
+			{
+				for (int i = 0; i < Common::DIMENSION; i++)
+				{
+					head = heads[i];
+					heads[i] = t;
+					const float val = d[i];
+					for (int j = head; j < tail; j++, t++)
+					{
+						prods[t] = val * prods[j];
+					}
+				}
+			}
+		}
+
+		float Dot(const float* coefficients, const float* prods) const
+		{
+			float sum = 0.0f;
+			for (int i = 0; i < count; i++)
+			{
+				sum += coefficients[i] * prods[i];
+			}
+			return sum;
+		}
+
+	private:
+		int p;
+		int count;
+		std::vector<float> C_k;
+	};
+
+	/// Calls func(monomials) with expansion unrolled for p_param if there is one, with generic expansion otherwise
+	template<typename Function>
+	void DispatchOrder(const int& p_param, const Function& func)
+	{
+		static_assert(MIN_FIXED_ORDER == 2 && MAX_FIXED_ORDER == 12, "switch below lists every fixed order");
+		switch (p_param)
+		{
+		case 2: func(FixedOrderMonomials<2>()); break;
+		case 3: func(FixedOrderMonomials<3>()); break;
+		case 4: func(FixedOrderMonomials<4>()); break;
+		case 5: func(FixedOrderMonomials<5>()); break;
+		case 6: func(FixedOrderMonomials<6>()); break;
+		case 7: func(FixedOrderMonomials<7>()); break;
+		case 8: func(FixedOrderMonomials<8>()); break;
+		case 9: func(FixedOrderMonomials<9>()); break;
+		case 10: func(FixedOrderMonomials<10>()); break;
+		case 11: func(FixedOrderMonomials<11>()); break;
+		case 12: func(FixedOrderMonomials<12>()); break;
+		default: func(GenericMonomials(p_param)); break;
+		}
+	}
+
+	template<typename Monomials>
+	void ComputeA_k(
+		const Monomials& monomials,
+		const std::vector<Common::Point_f>& cloud,
+		const std::vector<std::vector<float>>& weights,
+		const std::vector<Common::Point_f>& xc,
+		const std::vector<int>& indx,
+		const float& sigma,
+		const int& K_param,
+		Eigen::MatrixXf* A_k)
+	{
+		const int Nx = cloud.size();
+		const int W = static_cast<int>(weights.size());
+		const int pd = monomials.GetCount();
+		const float invertedSigma = 1.0f / sigma;
+		Common::Point_f dx = Common::Point_f::Zero();
+
+		auto prods = std::vector<float>(pd);
+
+		for (int n = 0; n < Nx; n++)
+		{
+			dx = cloud[n] - xc[indx[n]];
+			dx *= invertedSigma;
+
+			prods[0] = std::exp(-dx.LengthSquared());
+			monomials.Compute(dx, prods.data());
+
+			for (int w = 0; w < W; w++)
+			{
+				float* coefficients = A_k->col(indx[n]).data() + w * pd;
+				const float weight = weights[w][n];
+				for (int i = 0; i < pd; i++)
+				{
+					coefficients[i] += weight * prods[i];
+				}
+			}
+		}
+
+		for (int k = 0; k < K_param; k++)
+		{
+			for (int i = 0; i < A_k->rows(); i++)
+			{
+				(*A_k)(i, k) *= monomials.GetCoefficient(i % pd);
+			}
+		}
+	}
+
+	template<typename Monomials>
+	void ComputeFGTMultiPredict(
+		const Monomials& monomials,
+		const std::vector<Common::Point_f>& cloud,
+		const FGT_Model& fgt_model,
+		const float& sigma,
+		const float& e_param,
+		Eigen::MatrixXf* v)
+	{
+		const int Ny = cloud.size();
+		const int pd = monomials.GetCount();
+		const int W = v->cols();
+		const float invertedSigma = 1.0f / sigma;
+
+		// centers further than sigma * sqrt(e) are skipped, so every point only looks at centers from the grid cells around it
+		const Common::VoxelGrid centerGrid(fgt_model.xc, sigma * std::sqrt(e_param));
+
+		const auto predict_points = [&](int begin, int end) {
+			thread_local std::vector<float> prods;
+			thread_local std::vector<int> nearCenters;
+			Common::Point_f dy = Common::Point_f::Zero();
+
+			prods.resize(pd);
+
+			for (int m = begin; m < end; m++)
+			{
+				nearCenters.clear();
+				centerGrid.FindCandidates(cloud[m], &nearCenters);
+				// centers are summed in the same order as without the grid
+				std::sort(nearCenters.begin(), nearCenters.end());
+
+				for (const int kn : nearCenters)
+				{
+					dy = cloud[m] - fgt_model.xc[kn];
+					dy *= invertedSigma;
+					const float sum = dy.LengthSquared();
+
+					if (sum > e_param) continue; //skip to next kn
+
+					prods[0] = std::exp(-sum);
+					monomials.Compute(dy, prods.data());
+
+					// monomials are shared, only coefficients differ between weight vectors
+					const float* coefficients = fgt_model.Ak.col(kn).data();
+					for (int w = 0; w < W; w++)
+					{
+						(*v)(m, w) += monomials.Dot(coefficients + w * pd, prods.data());
+					}
+				}
+			}
+		};
+
+		Common::ThreadPool::GetInstance().ParallelFor(0, Ny, predict_points);
+	}
+}
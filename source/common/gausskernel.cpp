@@ -0,0 +1,247 @@
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#include "gausskernelsimd.h"
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#else
+	#include <cpuid.h>
+#endif
+
+namespace
+{
+	// Targets processed together, their denominators stay in registers or L1
+	constexpr int TARGET_TILE = 32;
+	// Source points processed together, 3 coordinates + p1 + 3 px columns of a tile fit in L1
+	constexpr int SOURCE_TILE = 1024;
+
+	// Coordinate of padding points, far enough that every exponent argument is below MIN_EXP_ARGUMENT
+	constexpr float PADDING_COORDINATE = 1e18f;
+
+	// Without vector instructions exp dominates the cost, so probabilities of a target are stored in a row
+	// and reused for p1 and px instead of being computed again in a second pass
+	void ComputeBlockWithRow(const CoherentPointDrift::SoaCloud& source, const std::vector<Common::Point_f>& target, int begin, int end,
+		float multiplier, float constant, float cutoff, float* pt1, float* p1, float* px, float* error)
+	{
+		const int paddedSize = source.GetPaddedSize();
+		thread_local std::vector<float> row;
+		row.resize(paddedSize);
+
+		for (int t = begin; t < end; t++)
+		{
+			float denominator = 0.0f;
+			for (int k = 0; k < source.GetSize(); k++)
+			{
+				const float dx = source.GetX()[k] - target[t].x;
+				const float dy = source.GetY()[k] - target[t].y;
+				const float dz = source.GetZ()[k] - target[t].z;
+				const float argument = multiplier * (dx * dx + dy * dy + dz * dz);
+				row[k] = argument < cutoff ? 0.0f : CoherentPointDrift::ExpApproximation(argument);
+				denominator += row[k];
+			}
+			denominator += constant;
+
+			pt1[t] = 1.0f - constant / denominator;
+			*error -= std::log(denominator);
+
+			const float inverseDenominator = 1.0f / denominator;
+			for (int k = 0; k < source.GetSize(); k++)
+			{
+				if (row[k] == 0.0f)
+					continue;
+
+				const float value = row[k] * inverseDenominator;
+				p1[k] += value;
+				px[k] += value * target[t].x;
+				px[paddedSize + k] += value * target[t].y;
+				px[2 * paddedSize + k] += value * target[t].z;
+			}
+		}
+	}
+
+	// Runs vector kernels over cache sized tiles of targets and source points, kernels are chosen by instruction set
+	void ComputeTiledBlock(CoherentPointDrift::SumGaussFunction sumGauss, CoherentPointDrift::AccumulateGaussFunction accumulateGauss,
+		const CoherentPointDrift::SoaCloud& source, const std::vector<Common::Point_f>& target, int begin, int end,
+		float multiplier, float constant, float cutoff, float* pt1, float* p1, float* px, float* error)
+	{
+		const int paddedSize = source.GetPaddedSize();
+		float inverseDenominators[TARGET_TILE];
+
+		for (int tileBegin = begin; tileBegin < end; tileBegin += TARGET_TILE)
+		{
+			const int tileEnd = std::min(end, tileBegin + TARGET_TILE);
+
+			// First pass: denominators of all targets in the tile
+			float denominators[TARGET_TILE] = {};
+			for (int sourceBegin = 0; sourceBegin < paddedSize; sourceBegin += SOURCE_TILE)
+			{
+				const int count = std::min(SOURCE_TILE, paddedSize - sourceBegin);
+				for (int t = tileBegin; t < tileEnd; t++)
+					denominators[t - tileBegin] += sumGauss(source.GetX() + sourceBegin, source.GetY() + sourceBegin, source.GetZ() + sourceBegin, count, target[t], multiplier, cutoff);
+			}
+
+			for (int t = tileBegin; t < tileEnd; t++)
+			{
+				const float denominator = denominators[t - tileBegin] + constant;
+				pt1[t] = 1.0f - constant / denominator;
+				*error -= std::log(denominator);
+				inverseDenominators[t - tileBegin] = 1.0f / denominator;
+			}
+
+			// Second pass: normalised probabilities summed into p1 and px, tile of p1 and px stays in cache for all targets
+			for (int sourceBegin = 0; sourceBegin < paddedSize; sourceBegin += SOURCE_TILE)
+			{
+				const int count = std::min(SOURCE_TILE, paddedSize - sourceBegin);
+				for (int t = tileBegin; t < tileEnd; t++)
+				{
+					accumulateGauss(source.GetX() + sourceBegin, source.GetY() + sourceBegin, source.GetZ() + sourceBegin, count, target[t], multiplier, cutoff, inverseDenominators[t - tileBegin],
+						p1 + sourceBegin, px + sourceBegin, px + paddedSize + sourceBegin, px + 2 * paddedSize + sourceBegin);
+				}
+			}
+		}
+	}
+
+	enum class InstructionSet
+	{
+		Scalar,
+		Avx2,
+		Avx512
+	};
+
+	// Registers eax, ebx, ecx, edx of cpuid for leaf and subleaf
+	std::array<uint32_t, 4> Cpuid(uint32_t leaf, uint32_t subleaf)
+	{
+		std::array<uint32_t, 4> registers = {};
+#ifdef _MSC_VER
+		int values[4];
+		__cpuidex(values, static_cast<int>(leaf), static_cast<int>(subleaf));
+		for (int i = 0; i < 4; i++)
+			registers[i] = static_cast<uint32_t>(values[i]);
+#else
+		__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+		return registers;
+	}
+
+	// Register states the operating system saves on context switch (XCR0)
+	uint64_t GetSavedRegisterStates()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		uint32_t low, high;
+		__asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+		return (static_cast<uint64_t>(high) << 32) | low;
+#endif
+	}
+
+	// Widest instruction set usable on this processor, vector registers also have to be enabled by the operating system
+	InstructionSet DetectInstructionSet()
+	{
+		constexpr uint32_t FMA_BIT = 1u << 12;
+		constexpr uint32_t OSXSAVE_BIT = 1u << 27;
+		constexpr uint32_t AVX_BIT = 1u << 28;
+		constexpr uint32_t AVX2_BIT = 1u << 5;
+		// /arch:AVX512 lets the compiler use F, CD, BW, DQ and VL
+		constexpr uint32_t AVX512_BITS = (1u << 16) | (1u << 17) | (1u << 28) | (1u << 30) | (1u << 31);
+		constexpr uint64_t YMM_STATES = 0x6;
+		constexpr uint64_t ZMM_STATES = 0xe6;
+
+		if (Cpuid(0, 0)[0] < 7)
+			return InstructionSet::Scalar;
+
+		const uint32_t features = Cpuid(1, 0)[2];
+		if ((features & (FMA_BIT | OSXSAVE_BIT | AVX_BIT)) != (FMA_BIT | OSXSAVE_BIT | AVX_BIT))
+			return InstructionSet::Scalar;
+
+		const uint64_t states = GetSavedRegisterStates();
+		if ((states & YMM_STATES) != YMM_STATES)
+			return InstructionSet::Scalar;
+
+		const uint32_t extendedFeatures = Cpuid(7, 0)[1];
+		if ((extendedFeatures & AVX512_BITS) == AVX512_BITS && (states & ZMM_STATES) == ZMM_STATES)
+			return InstructionSet::Avx512;
+
+		return (extendedFeatures & AVX2_BIT) != 0 ? InstructionSet::Avx2 : InstructionSet::Scalar;
+	}
+}
+
+namespace CoherentPointDrift
+{
+	float ExpApproximation(float x)
+	{
+		x = std::min(x, EXP_MAX_ARGUMENT);
+		x = std::max(x, MIN_EXP_ARGUMENT);
+
+		const float fx = std::floor(x * LOG2E + 0.5f);
+		x -= fx * LN2_HIGH;
+		x -= fx * LN2_LOW;
+
+		const float z = x * x;
+		float y = EXP_P0;
+		y = y * x + EXP_P1;
+		y = y * x + EXP_P2;
+		y = y * x + EXP_P3;
+		y = y * x + EXP_P4;
+		y = y * x + EXP_P5;
+		y = y * z + x + 1.0f;
+
+		const int exponent = (static_cast<int>(fx) + 127) << 23;
+		float scale;
+		std::memcpy(&scale, &exponent, sizeof(float));
+		return y * scale;
+	}
+
+	void SoaCloud::Assign(const std::vector<Common::Point_f>& cloud)
+	{
+		size = static_cast<int>(cloud.size());
+		const int paddedSize = (size + GAUSS_KERNEL_PADDING - 1) / GAUSS_KERNEL_PADDING * GAUSS_KERNEL_PADDING;
+
+		x.resize(paddedSize);
+		y.resize(paddedSize);
+		z.resize(paddedSize);
+
+		for (int i = 0; i < size; i++)
+		{
+			x[i] = cloud[i].x;
+			y[i] = cloud[i].y;
+			z[i] = cloud[i].z;
+		}
+
+		std::fill(x.begin() + size, x.end(), PADDING_COORDINATE);
+		std::fill(y.begin() + size, y.end(), PADDING_COORDINATE);
+		std::fill(z.begin() + size, z.end(), PADDING_COORDINATE);
+	}
+
+	void ComputeGaussKernelBlock(
+		const SoaCloud& source,
+		const std::vector<Common::Point_f>& target,
+		int begin,
+		int end,
+		float multiplier,
+		float constant,
+		float cutoff,
+		float* pt1,
+		float* p1,
+		float* px,
+		float* error)
+	{
+		cutoff = std::max(cutoff, MIN_EXP_ARGUMENT);
+
+		static const InstructionSet instructionSet = DetectInstructionSet();
+		switch (instructionSet)
+		{
+		case InstructionSet::Avx512:
+			ComputeTiledBlock(SumGaussAvx512, AccumulateGaussAvx512, source, target, begin, end, multiplier, constant, cutoff, pt1, p1, px, error);
+			break;
+		case InstructionSet::Avx2:
+			ComputeTiledBlock(SumGaussAvx2, AccumulateGaussAvx2, source, target, begin, end, multiplier, constant, cutoff, pt1, p1, px, error);
+			break;
+		default:
+			ComputeBlockWithRow(source, target, begin, end, multiplier, constant, cutoff, pt1, p1, px, error);
+			break;
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "_common.h"
+
+namespace CoherentPointDrift
+{
+	/// Clouds passed to the kernel are padded to a multiple of this length, enough for the widest vector instructions (AVX-512)
+	constexpr int GAUSS_KERNEL_PADDING = 16;
+
+	/// Smallest argument for which ExpApproximation is evaluated, smaller arguments give 0 (e^-87.3 is the smallest normal float)
+	constexpr float MIN_EXP_ARGUMENT = -87.33654f;
+
+	/// Cephes style exp approximation used by the E-step kernel: range reduction to [-ln2/2, ln2/2] and a degree 5 polynomial.
+	/// Relative error is below 2e-7 (about 2 ulp) for arguments in [MIN_EXP_ARGUMENT, 88.3], vector versions use the same coefficients
+	float ExpApproximation(float x);
+
+	/// Cloud in structure of arrays layout. Points are padded to multiple of GAUSS_KERNEL_PADDING with points
+	/// placed so far away that their probabilities are exactly zero
+	class SoaCloud
+	{
+	public:
+		/// Copies the cloud, buffers are only reallocated if the cloud got bigger
+		void Assign(const std::vector<Common::Point_f>& cloud);
+
+		int GetSize() const { return size; }
+		int GetPaddedSize() const { return static_cast<int>(x.size()); }
+		const float* GetX() const { return x.data(); }
+		const float* GetY() const { return y.data(); }
+		const float* GetZ() const { return z.data(); }
+
+	private:
+		int size = 0;
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<float> z;
+	};
+
+	/// Tiled, vectorised E-step for targets [begin, end). For every target it computes denominator of its probabilities
+	/// over all source points, then adds normalised probabilities to p1 and px in a second pass over cache sized tiles of source points.
+	/// Uses AVX-512 or AVX2 when the processor supports them, checked once at run time. Scalar fallback makes a single pass per target and keeps its probabilities in a row instead
+	/// \param multiplier -1 / (2 * sigmaSquared)
+	/// \param cutoff Exponent arguments smaller than cutoff give zero probability (truncated Gaussian), at least MIN_EXP_ARGUMENT
+	/// \param pt1 Output for targets [begin, end), indexed by target index
+	/// \param p1 Accumulated for every source point, length source.GetPaddedSize()
+	/// \param px Accumulated in column major layout with column length source.GetPaddedSize()
+	/// \param error Accumulated sum of -log(denominator)
+	void ComputeGaussKernelBlock(
+		const SoaCloud& source,
+		const std::vector<Common::Point_f>& target,
+		int begin,
+		int end,
+		float multiplier,
+		float constant,
+		float cutoff,
+		float* pt1,
+		float* p1,
+		float* px,
+		float* error);
+}
@@ -0,0 +1,73 @@
+#include <immintrin.h>
+
+#include "gausskernelsimd.h"
+
+// Compiled with AVX2 and FMA enabled, called only when the processor and the operating system support them
+namespace CoherentPointDrift
+{
+	namespace
+	{
+		constexpr int WIDTH = 8;
+
+		__m256 Exp(__m256 x)
+		{
+			x = _mm256_min_ps(x, _mm256_set1_ps(EXP_MAX_ARGUMENT));
+			x = _mm256_max_ps(x, _mm256_set1_ps(MIN_EXP_ARGUMENT));
+
+			const __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(LOG2E), _mm256_set1_ps(0.5f)));
+			x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(LN2_HIGH), x);
+			x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(LN2_LOW), x);
+
+			const __m256 z = _mm256_mul_ps(x, x);
+			__m256 y = _mm256_set1_ps(EXP_P0);
+			y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P1));
+			y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P2));
+			y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P3));
+			y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P4));
+			y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P5));
+			y = _mm256_fmadd_ps(y, z, _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+
+			const __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+			return _mm256_mul_ps(y, _mm256_castsi256_ps(exponent));
+		}
+
+		// e^(multiplier * |source - target|^2) for WIDTH source points, zero below cutoff
+		__m256 Gauss(const float* sx, const float* sy, const float* sz, const Common::Point_f& target, float multiplier, float cutoff)
+		{
+			const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(sx), _mm256_set1_ps(target.x));
+			const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(sy), _mm256_set1_ps(target.y));
+			const __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(sz), _mm256_set1_ps(target.z));
+			const __m256 distance = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+			const __m256 argument = _mm256_mul_ps(distance, _mm256_set1_ps(multiplier));
+			const __m256 inside = _mm256_cmp_ps(argument, _mm256_set1_ps(cutoff), _CMP_GE_OQ);
+			return _mm256_and_ps(inside, Exp(argument));
+		}
+	}
+
+	float SumGaussAvx2(const float* sx, const float* sy, const float* sz, int count, const Common::Point_f& target, float multiplier, float cutoff)
+	{
+		__m256 sum = _mm256_setzero_ps();
+		for (int k = 0; k < count; k += WIDTH)
+			sum = _mm256_add_ps(sum, Gauss(sx + k, sy + k, sz + k, target, multiplier, cutoff));
+
+		const __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+		const __m128 quarter = _mm_add_ps(half, _mm_movehl_ps(half, half));
+		return _mm_cvtss_f32(_mm_add_ss(quarter, _mm_movehdup_ps(quarter)));
+	}
+
+	void AccumulateGaussAvx2(const float* sx, const float* sy, const float* sz, int count, const Common::Point_f& target, float multiplier, float cutoff, float scale,
+		float* p1, float* pxX, float* pxY, float* pxZ)
+	{
+		const __m256 tx = _mm256_set1_ps(target.x);
+		const __m256 ty = _mm256_set1_ps(target.y);
+		const __m256 tz = _mm256_set1_ps(target.z);
+		for (int k = 0; k < count; k += WIDTH)
+		{
+			const __m256 value = _mm256_mul_ps(Gauss(sx + k, sy + k, sz + k, target, multiplier, cutoff), _mm256_set1_ps(scale));
+			_mm256_storeu_ps(p1 + k, _mm256_add_ps(_mm256_loadu_ps(p1 + k), value));
+			_mm256_storeu_ps(pxX + k, _mm256_fmadd_ps(value, tx, _mm256_loadu_ps(pxX + k)));
+			_mm256_storeu_ps(pxY + k, _mm256_fmadd_ps(value, ty, _mm256_loadu_ps(pxY + k)));
+			_mm256_storeu_ps(pxZ + k, _mm256_fmadd_ps(value, tz, _mm256_loadu_ps(pxZ + k)));
+		}
+	}
+}
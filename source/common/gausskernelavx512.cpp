@@ -0,0 +1,70 @@
+#include <immintrin.h>
+
+#include "gausskernelsimd.h"
+
+// Compiled with AVX-512 enabled, called only when the processor and the operating system support it
+namespace CoherentPointDrift
+{
+	namespace
+	{
+		constexpr int WIDTH = 16;
+
+		__m512 Exp(__m512 x)
+		{
+			x = _mm512_min_ps(x, _mm512_set1_ps(EXP_MAX_ARGUMENT));
+			x = _mm512_max_ps(x, _mm512_set1_ps(MIN_EXP_ARGUMENT));
+
+			const __m512 fx = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(LOG2E), _mm512_set1_ps(0.5f)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+			x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(LN2_HIGH), x);
+			x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(LN2_LOW), x);
+
+			const __m512 z = _mm512_mul_ps(x, x);
+			__m512 y = _mm512_set1_ps(EXP_P0);
+			y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P1));
+			y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P2));
+			y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P3));
+			y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P4));
+			y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P5));
+			y = _mm512_fmadd_ps(y, z, _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+
+			const __m512i exponent = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(fx), _mm512_set1_epi32(127)), 23);
+			return _mm512_mul_ps(y, _mm512_castsi512_ps(exponent));
+		}
+
+		// e^(multiplier * |source - target|^2) for WIDTH source points, zero below cutoff
+		__m512 Gauss(const float* sx, const float* sy, const float* sz, const Common::Point_f& target, float multiplier, float cutoff)
+		{
+			const __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(sx), _mm512_set1_ps(target.x));
+			const __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(sy), _mm512_set1_ps(target.y));
+			const __m512 dz = _mm512_sub_ps(_mm512_loadu_ps(sz), _mm512_set1_ps(target.z));
+			const __m512 distance = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+			const __m512 argument = _mm512_mul_ps(distance, _mm512_set1_ps(multiplier));
+			const __mmask16 inside = _mm512_cmp_ps_mask(argument, _mm512_set1_ps(cutoff), _CMP_GE_OQ);
+			return _mm512_maskz_mov_ps(inside, Exp(argument));
+		}
+	}
+
+	float SumGaussAvx512(const float* sx, const float* sy, const float* sz, int count, const Common::Point_f& target, float multiplier, float cutoff)
+	{
+		__m512 sum = _mm512_setzero_ps();
+		for (int k = 0; k < count; k += WIDTH)
+			sum = _mm512_add_ps(sum, Gauss(sx + k, sy + k, sz + k, target, multiplier, cutoff));
+		return _mm512_reduce_add_ps(sum);
+	}
+
+	void AccumulateGaussAvx512(const float* sx, const float* sy, const float* sz, int count, const Common::Point_f& target, float multiplier, float cutoff, float scale,
+		float* p1, float* pxX, float* pxY, float* pxZ)
+	{
+		const __m512 tx = _mm512_set1_ps(target.x);
+		const __m512 ty = _mm512_set1_ps(target.y);
+		const __m512 tz = _mm512_set1_ps(target.z);
+		for (int k = 0; k < count; k += WIDTH)
+		{
+			const __m512 value = _mm512_mul_ps(Gauss(sx + k, sy + k, sz + k, target, multiplier, cutoff), _mm512_set1_ps(scale));
+			_mm512_storeu_ps(p1 + k, _mm512_add_ps(_mm512_loadu_ps(p1 + k), value));
+			_mm512_storeu_ps(pxX + k, _mm512_fmadd_ps(value, tx, _mm512_loadu_ps(pxX + k)));
+			_mm512_storeu_ps(pxY + k, _mm512_fmadd_ps(value, ty, _mm512_loadu_ps(pxY + k)));
+			_mm512_storeu_ps(pxZ + k, _mm512_fmadd_ps(value, tz, _mm512_loadu_ps(pxZ + k)));
+		}
+	}
+}
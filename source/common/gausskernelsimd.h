@@ -0,0 +1,34 @@
+#pragma once
+
+#include "gausskernel.h"
+
+// Internal to the E-step kernel. Vector versions live in their own translation units compiled for their instruction set,
+// ComputeGaussKernelBlock calls them only after checking the processor supports it
+namespace CoherentPointDrift
+{
+	constexpr float EXP_MAX_ARGUMENT = 88.3762626647949f;
+	constexpr float LOG2E = 1.44269504088896341f;
+	constexpr float LN2_HIGH = 0.693359375f;
+	constexpr float LN2_LOW = -2.12194440e-4f;
+	constexpr float EXP_P0 = 1.9875691500e-4f;
+	constexpr float EXP_P1 = 1.3981999507e-3f;
+	constexpr float EXP_P2 = 8.3334519073e-3f;
+	constexpr float EXP_P3 = 4.1665795894e-2f;
+	constexpr float EXP_P4 = 1.6666665459e-1f;
+	constexpr float EXP_P5 = 5.0000001201e-1f;
+
+	/// Sum of e^(multiplier * |source - target|^2) over count source points, zero below cutoff. Count is a multiple of GAUSS_KERNEL_PADDING
+	using SumGaussFunction = float(*)(const float* sx, const float* sy, const float* sz, int count, const Common::Point_f& target, float multiplier, float cutoff);
+
+	/// Adds scale * e^(multiplier * |source - target|^2) to p1 and its products with target to px columns, for count source points
+	using AccumulateGaussFunction = void(*)(const float* sx, const float* sy, const float* sz, int count, const Common::Point_f& target, float multiplier, float cutoff, float scale,
+		float* p1, float* pxX, float* pxY, float* pxZ);
+
+	float SumGaussAvx2(const float* sx, const float* sy, const float* sz, int count, const Common::Point_f& target, float multiplier, float cutoff);
+	void AccumulateGaussAvx2(const float* sx, const float* sy, const float* sz, int count, const Common::Point_f& target, float multiplier, float cutoff, float scale,
+		float* p1, float* pxX, float* pxY, float* pxZ);
+
+	float SumGaussAvx512(const float* sx, const float* sy, const float* sz, int count, const Common::Point_f& target, float multiplier, float cutoff);
+	void AccumulateGaussAvx512(const float* sx, const float* sy, const float* sz, int count, const Common::Point_f& target, float multiplier, float cutoff, float scale,
+		float* p1, float* pxX, float* pxY, float* pxZ);
+}
@@ -0,0 +1,100 @@
+#include "kabsch.h"
+#include "common.h"
+
+namespace
+{
+	Eigen::Vector3d ToVector(const Common::Point_f& point)
+	{
+		return Eigen::Vector3d(point.x, point.y, point.z);
+	}
+}
+
+namespace Common
+{
+	void KabschAccumulator::Add(const Point_f& before, const Point_f& after, double weight)
+	{
+		AddWeighted(before, weight * ToVector(after), weight);
+	}
+
+	void KabschAccumulator::AddWeighted(const Point_f& before, const Eigen::Vector3d& weightedAfter, double weight)
+	{
+		const Eigen::Vector3d pointBefore = ToVector(before);
+
+		this->weight += weight;
+		sumSquaredBefore += weight * pointBefore.squaredNorm();
+		sumBefore += weight * pointBefore;
+		sumAfter += weightedAfter;
+		sumOuter += weightedAfter * pointBefore.transpose();
+	}
+
+	void KabschAccumulator::Merge(const KabschAccumulator& other)
+	{
+		weight += other.weight;
+		sumSquaredBefore += other.sumSquaredBefore;
+		sumBefore += other.sumBefore;
+		sumAfter += other.sumAfter;
+		sumOuter += other.sumOuter;
+	}
+
+	Eigen::Vector3d KabschAccumulator::GetCenterBefore() const
+	{
+		return weight > 0.0 ? Eigen::Vector3d(sumBefore / weight) : Eigen::Vector3d::Zero();
+	}
+
+	Eigen::Vector3d KabschAccumulator::GetCenterAfter() const
+	{
+		return weight > 0.0 ? Eigen::Vector3d(sumAfter / weight) : Eigen::Vector3d::Zero();
+	}
+
+	Eigen::Matrix3d KabschAccumulator::GetCrossCovariance() const
+	{
+		if (weight <= 0.0)
+			return Eigen::Matrix3d::Zero();
+
+		return sumOuter - sumAfter * sumBefore.transpose() / weight;
+	}
+
+	double KabschAccumulator::GetVarianceBefore() const
+	{
+		if (weight <= 0.0)
+			return 0.0;
+
+		return sumSquaredBefore - sumBefore.squaredNorm() / weight;
+	}
+
+	Eigen::Matrix3d KabschAccumulator::GetRotation() const
+	{
+		if (weight <= 0.0)
+			return Eigen::Matrix3d::Identity();
+
+		// s(i, j) is sum of before_i * after_j, notation from Horn's paper
+		const Eigen::Matrix3d s = GetCrossCovariance().transpose();
+
+		Eigen::Matrix4d n;
+		n << s(0, 0) + s(1, 1) + s(2, 2), s(1, 2) - s(2, 1), s(2, 0) - s(0, 2), s(0, 1) - s(1, 0),
+			s(1, 2) - s(2, 1), s(0, 0) - s(1, 1) - s(2, 2), s(0, 1) + s(1, 0), s(2, 0) + s(0, 2),
+			s(2, 0) - s(0, 2), s(0, 1) + s(1, 0), -s(0, 0) + s(1, 1) - s(2, 2), s(1, 2) + s(2, 1),
+			s(0, 1) - s(1, 0), s(2, 0) + s(0, 2), s(1, 2) + s(2, 1), -s(0, 0) - s(1, 1) + s(2, 2);
+
+		// Optimal rotation is the unit quaternion along eigenvector of the largest eigenvalue (eigenvalues are sorted increasingly)
+		const Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> solver(n);
+		const Eigen::Vector4d q = solver.eigenvectors().col(3);
+
+		return Eigen::Quaterniond(q(0), q(1), q(2), q(3)).normalized().toRotationMatrix();
+	}
+
+	std::pair<glm::mat3, glm::vec3> KabschAccumulator::GetTransformation() const
+	{
+		const Eigen::Matrix3d rotation = GetRotation();
+		const Eigen::Vector3d translation = GetCenterAfter() - rotation * GetCenterBefore();
+
+		return std::make_pair(ConvertRotationMatrix(rotation.cast<float>()), ConvertTranslationVector(translation.cast<float>()));
+	}
+
+	KabschAccumulator AccumulateCorrespondences(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const std::vector<int>& indexesBefore, const std::vector<int>& indexesAfter, bool parallel)
+	{
+		return AccumulatePairs(static_cast<int>(indexesBefore.size()), parallel, [&](KabschAccumulator* accumulator, int i) {
+			accumulator->Add(cloudBefore[indexesBefore[i]], cloudAfter[indexesAfter[i]]);
+		});
+	}
+}
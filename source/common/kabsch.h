@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <Eigen/Dense>
+
+#include "_common.h"
+#include "threadpool.h"
+
+namespace Common
+{
+	/// Streaming weighted sums of point pairs, enough to find the rigid transformation between them (Kabsch problem)
+	/// without storing the points. Sums are kept in double precision, so that single pass centering is accurate
+	class KabschAccumulator
+	{
+	public:
+		void Add(const Point_f& before, const Point_f& after, double weight = 1.0);
+		/// Adds pair when the after point is already multiplied by weight, e.g. row of P * X in CPD
+		void AddWeighted(const Point_f& before, const Eigen::Vector3d& weightedAfter, double weight);
+		void Merge(const KabschAccumulator& other);
+
+		double GetWeight() const { return weight; }
+		Eigen::Vector3d GetCenterBefore() const;
+		Eigen::Vector3d GetCenterAfter() const;
+		/// Sum of weight * (after - centerAfter) * (before - centerBefore)^T
+		Eigen::Matrix3d GetCrossCovariance() const;
+		/// Sum of weight * |before - centerBefore|^2
+		double GetVarianceBefore() const;
+
+		/// Rotation maximizing trace(R^T * crossCovariance), solved in closed form with Horn's quaternion method.
+		/// Result is always a proper rotation, identity when no pairs were added
+		Eigen::Matrix3d GetRotation() const;
+		/// Rotation and translation moving points before onto points after
+		std::pair<glm::mat3, glm::vec3> GetTransformation() const;
+
+	private:
+		double weight = 0.0;
+		double sumSquaredBefore = 0.0;
+		Eigen::Vector3d sumBefore = Eigen::Vector3d::Zero();
+		Eigen::Vector3d sumAfter = Eigen::Vector3d::Zero();
+		// Sum of weight * after * before^T
+		Eigen::Matrix3d sumOuter = Eigen::Matrix3d::Zero();
+	};
+
+	/// Number of partial sums used by AccumulatePairs, independent of thread count so results are reproducible
+	constexpr int ACCUMULATOR_CHUNKS = 64;
+
+	/// Accumulates count pairs in one pass, add_pair(accumulator, i) adds i-th pair.
+	/// Partial sums of fixed chunks are merged in order, so result is the same for parallel and sequential execution
+	template<typename AddPair>
+	KabschAccumulator AccumulatePairs(int count, bool parallel, const AddPair& add_pair)
+	{
+		std::array<KabschAccumulator, ACCUMULATOR_CHUNKS> partials;
+		const int chunkLength = (count + ACCUMULATOR_CHUNKS - 1) / ACCUMULATOR_CHUNKS;
+
+		const auto accumulate_chunks = [&](int beginChunk, int endChunk) {
+			for (int chunk = beginChunk; chunk < endChunk; chunk++)
+			{
+				const int end = std::min(count, (chunk + 1) * chunkLength);
+				for (int i = chunk * chunkLength; i < end; i++)
+					add_pair(&partials[chunk], i);
+			}
+		};
+
+		if (parallel)
+			ThreadPool::GetInstance().ParallelFor(0, ACCUMULATOR_CHUNKS, accumulate_chunks, 1);
+		else
+			accumulate_chunks(0, ACCUMULATOR_CHUNKS);
+
+		for (int chunk = 1; chunk < ACCUMULATOR_CHUNKS; chunk++)
+			partials[0].Merge(partials[chunk]);
+
+		return partials[0];
+	}
+
+	/// Accumulates pairs cloudBefore[indexesBefore[i]], cloudAfter[indexesAfter[i]]
+	KabschAccumulator AccumulateCorrespondences(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, const std::vector<int>& indexesBefore, const std::vector<int>& indexesAfter, bool parallel);
+}
@@ -0,0 +1,148 @@
+#include "kdtree.h"
+
+namespace
+{
+	constexpr int LEAF_SIZE = 8;
+}
+
+namespace Common
+{
+	KdTree::KdTree(const std::vector<Point_f>& cloud) : points(cloud), indices(cloud.size())
+	{
+		std::iota(indices.begin(), indices.end(), 0);
+		if (points.empty())
+			return;
+
+		nodes.reserve(4 * points.size() / LEAF_SIZE + 1);
+		Build(0, static_cast<int>(points.size()));
+
+		// store points in tree order, so that leaves are scanned sequentially in memory
+		std::transform(indices.begin(), indices.end(), points.begin(), [&cloud](int index) { return cloud[index]; });
+	}
+
+	int KdTree::Build(int begin, int end)
+	{
+		const int nodeIndex = static_cast<int>(nodes.size());
+		nodes.push_back(Node());
+		nodes[nodeIndex].begin = begin;
+		nodes[nodeIndex].end = end;
+
+		if (end - begin <= LEAF_SIZE)
+			return nodeIndex;
+
+		// split along the axis with the largest extent, points are still in original order here
+		Point_f min = points[indices[begin]];
+		Point_f max = points[indices[begin]];
+		for (int i = begin + 1; i < end; i++)
+		{
+			const auto& p = points[indices[i]];
+			min = { std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+			max = { std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+		}
+
+		const Point_f extent = max - min;
+		int axis = 0;
+		for (int i = 1; i < DIMENSION; i++)
+			if (extent[i] > extent[axis])
+				axis = i;
+
+		const int middle = begin + (end - begin) / 2;
+		std::nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end, [this, axis](int a, int b) { return points[a][axis] < points[b][axis]; });
+		const float split = points[indices[middle]][axis];
+
+		const int left = Build(begin, middle);
+		const int right = Build(middle, end);
+
+		nodes[nodeIndex].axis = axis;
+		nodes[nodeIndex].split = split;
+		nodes[nodeIndex].left = left;
+		nodes[nodeIndex].right = right;
+		return nodeIndex;
+	}
+
+	int KdTree::FindNearest(const Point_f& point, float maxDistanceSquared) const
+	{
+		if (nodes.empty())
+			return -1;
+
+		int bestIndex = -1;
+		float bestDistance = maxDistanceSquared;
+		SearchNearest(0, point, &bestIndex, &bestDistance);
+
+		return bestIndex >= 0 ? indices[bestIndex] : -1;
+	}
+
+	void KdTree::SearchNearest(int nodeIndex, const Point_f& point, int* bestIndex, float* bestDistance) const
+	{
+		const Node& node = nodes[nodeIndex];
+		if (node.left == -1)
+		{
+			for (int i = node.begin; i < node.end; i++)
+			{
+				const float distance = (points[i] - point).LengthSquared();
+				if (distance < *bestDistance)
+				{
+					*bestDistance = distance;
+					*bestIndex = i;
+				}
+			}
+			return;
+		}
+
+		const float diff = point[node.axis] - node.split;
+		const int nearChild = diff < 0 ? node.left : node.right;
+		const int farChild = diff < 0 ? node.right : node.left;
+
+		SearchNearest(nearChild, point, bestIndex, bestDistance);
+		if (diff * diff < *bestDistance)
+			SearchNearest(farChild, point, bestIndex, bestDistance);
+	}
+
+	std::vector<int> KdTree::FindKNearest(const Point_f& point, int k) const
+	{
+		if (nodes.empty() || k <= 0)
+			return std::vector<int>();
+
+		// max-heap of (distance, reordered index), top is the worst of the current k candidates
+		std::priority_queue<std::pair<float, int>> heap;
+		SearchKNearest(0, point, k, heap);
+
+		std::vector<int> result(heap.size());
+		for (int i = static_cast<int>(result.size()) - 1; i >= 0; i--)
+		{
+			result[i] = indices[heap.top().second];
+			heap.pop();
+		}
+		return result;
+	}
+
+	void KdTree::SearchKNearest(int nodeIndex, const Point_f& point, int k, std::priority_queue<std::pair<float, int>>& heap) const
+	{
+		const Node& node = nodes[nodeIndex];
+		if (node.left == -1)
+		{
+			for (int i = node.begin; i < node.end; i++)
+			{
+				const float distance = (points[i] - point).LengthSquared();
+				if (static_cast<int>(heap.size()) < k)
+				{
+					heap.push(std::make_pair(distance, i));
+				}
+				else if (distance < heap.top().first)
+				{
+					heap.pop();
+					heap.push(std::make_pair(distance, i));
+				}
+			}
+			return;
+		}
+
+		const float diff = point[node.axis] - node.split;
+		const int nearChild = diff < 0 ? node.left : node.right;
+		const int farChild = diff < 0 ? node.right : node.left;
+
+		SearchKNearest(nearChild, point, k, heap);
+		if (static_cast<int>(heap.size()) < k || diff * diff < heap.top().first)
+			SearchKNearest(farChild, point, k, heap);
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <limits>
+
+#include "_common.h"
+
+namespace Common
+{
+	/// Static KD-tree over a point cloud. Built once per registration and queried many times
+	class KdTree
+	{
+	public:
+		KdTree() = default;
+		explicit KdTree(const std::vector<Point_f>& cloud);
+
+		/// Returns index of the closest point in the indexed cloud or -1 if no point is closer than maxDistanceSquared
+		int FindNearest(const Point_f& point, float maxDistanceSquared = std::numeric_limits<float>::max()) const;
+
+		/// Returns indices of (at most) k closest points in the indexed cloud, sorted by ascending distance
+		std::vector<int> FindKNearest(const Point_f& point, int k) const;
+
+		int GetSize() const { return static_cast<int>(points.size()); }
+
+	private:
+		struct Node
+		{
+			// Range of points in the reordered cloud covered by this node
+			int begin = 0;
+			int end = 0;
+			// Children indices, -1 for leaves
+			int left = -1;
+			int right = -1;
+			int axis = 0;
+			float split = 0.f;
+		};
+
+		int Build(int begin, int end);
+		void SearchNearest(int nodeIndex, const Point_f& point, int* bestIndex, float* bestDistance) const;
+		void SearchKNearest(int nodeIndex, const Point_f& point, int k, std::priority_queue<std::pair<float, int>>& heap) const;
+
+		// Points reordered so that each node covers continuous range
+		std::vector<Point_f> points;
+		// Index of every reordered point in the original cloud
+		std::vector<int> indices;
+		std::vector<Node> nodes;
+	};
+}
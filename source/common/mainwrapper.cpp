@@ -1,8 +1,9 @@
 #include "mainwrapper.h"
+#include "threadpool.h"
 
 namespace Common
 {
-	int Main(int argc, char** argv, const char* windowName, const SlamFunc& func)
+	int Main(int argc, char** argv, const char* windowName, const SlamFunc& func, const std::vector<ComputationMethod>& unsupportedMethods)
 	{
 		auto configParser = ConfigParser(argc, argv);
 		if (!configParser.IsCorrect())
@@ -12,10 +13,17 @@ namespace Common
 		}
 
 		Configuration configuration = configParser.GetConfiguration();
+		if (std::find(unsupportedMethods.begin(), unsupportedMethods.end(), configuration.ComputationMethod) != unsupportedMethods.end())
+		{
+			printf("Parsing error: Computational method not supported by %s\n", windowName);
+			printf("Aborting\n");
+			return -1;
+		}
+
 		configuration.Print();
 
-		const auto seed = configuration.RandomSeed.has_value() ? static_cast<unsigned int>(configuration.RandomSeed.value()) : time(nullptr);
-		srand(seed);
+		const auto threadCount = configuration.ThreadCount.value_or(static_cast<int>(std::thread::hardware_concurrency()));
+		ThreadPool::GetInstance().Resize(threadCount, configuration.ThreadAffinity);
 
 		auto [before, after] = GetCloudsFromConfig(configuration);
 
@@ -9,5 +9,6 @@
 
 namespace Common
 {
-	int Main(int argc, char** argv, const char* windowName, const SlamFunc& func);
+	/// Runs the method from configuration given in arguments, methods not implemented by func are rejected like parsing errors
+	int Main(int argc, char** argv, const char* windowName, const SlamFunc& func, const std::vector<ComputationMethod>& unsupportedMethods = {});
 }
@@ -1,27 +1,202 @@
 #include "nicputils.h"
+#include "kabsch.h"
+#include "threadpool.h"
+
+namespace
+{
+	// Calls accumulate_chunk(chunk, begin, end) for every one of ACCUMULATOR_CHUNKS fixed chunks of [0, count).
+	// Partial sums of chunks are merged in order by the caller, so results do not depend on thread count
+	template<typename AccumulateChunk>
+	void AccumulateChunks(int count, bool parallel, const AccumulateChunk& accumulate_chunk)
+	{
+		const int chunkLength = (count + Common::ACCUMULATOR_CHUNKS - 1) / Common::ACCUMULATOR_CHUNKS;
+		const auto accumulate_chunks = [&](int beginChunk, int endChunk) {
+			for (int chunk = beginChunk; chunk < endChunk; chunk++)
+				accumulate_chunk(chunk, std::min(count, chunk * chunkLength), std::min(count, (chunk + 1) * chunkLength));
+		};
+
+		if (parallel)
+			Common::ThreadPool::GetInstance().ParallelFor(0, Common::ACCUMULATOR_CHUNKS, accumulate_chunks, 1);
+		else
+			accumulate_chunks(0, Common::ACCUMULATOR_CHUNKS);
+	}
+
+	// Results of the heap are the same transformation when no entry of rotation matrices differs by more than this,
+	// nor any coordinate of translations relative to the larger translation, at least 1
+	constexpr float DUPLICATE_TOLERANCE = 1e-5f;
+}
 
 namespace Common
 {
-	void StoreResultIfOptimal(std::vector<NonIterativeSlamResult>& results, const NonIterativeSlamResult& newResult, const int desiredLength)
+	NonIterativeResultHeap::NonIterativeResultHeap(int capacity)
+		: capacity(std::max(capacity, 0)), threshold(std::numeric_limits<float>::infinity())
 	{
-		int length = results.size();
-		if (length == 0 && desiredLength > 0)
+		entries.reserve(this->capacity + 1);
+	}
+
+	bool NonIterativeResultHeap::Push(const NonIterativeSlamResult& result, int repetition)
+	{
+		// Equal errors are decided by repetition under the lock
+		if (capacity == 0 || result.getApproximatedError() > threshold.load(std::memory_order_relaxed))
+			return false;
+
+		const Entry entry{ result, repetition };
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// Repetitions may find the same transformation, only the better of the copies is kept
+		const auto duplicate = std::find_if(entries.begin(), entries.end(), [&result](const Entry& kept) { return IsSameTransformation(kept.result, result); });
+		if (duplicate != entries.end())
 		{
-			results.push_back(newResult);
-			return;
+			if (!IsBetter(entry, *duplicate))
+				return false;
+
+			*duplicate = entry;
+			std::make_heap(entries.begin(), entries.end(), IsBetter);
+			if (entries.size() == capacity)
+				threshold.store(entries.front().result.getApproximatedError(), std::memory_order_relaxed);
+
+			return true;
 		}
 
-		for (int i = 0; i < length; i++)
+		if (entries.size() == capacity)
 		{
-			if (newResult.getApproximatedError() < results[i].getApproximatedError())
+			if (!IsBetter(entry, entries.front()))
+				return false;
+
+			std::pop_heap(entries.begin(), entries.end(), IsBetter);
+			entries.pop_back();
+		}
+
+		entries.push_back(entry);
+		std::push_heap(entries.begin(), entries.end(), IsBetter);
+
+		if (entries.size() == capacity)
+			threshold.store(entries.front().result.getApproximatedError(), std::memory_order_relaxed);
+
+		return true;
+	}
+
+	std::vector<NonIterativeResultHeap::Entry> NonIterativeResultHeap::GetSorted() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto sorted = entries;
+		std::sort(sorted.begin(), sorted.end(), IsBetter);
+		return sorted;
+	}
+
+	bool NonIterativeResultHeap::IsBetter(const Entry& first, const Entry& second)
+	{
+		if (first.result.getApproximatedError() != second.result.getApproximatedError())
+			return first.result.getApproximatedError() < second.result.getApproximatedError();
+
+		return first.repetition < second.repetition;
+	}
+
+	bool NonIterativeResultHeap::IsSameTransformation(const NonIterativeSlamResult& first, const NonIterativeSlamResult& second)
+	{
+		const glm::mat3 firstRotation = first.getRotationMatrix();
+		const glm::mat3 secondRotation = second.getRotationMatrix();
+		const glm::vec3 firstTranslation = first.getTranslationVector();
+		const glm::vec3 secondTranslation = second.getTranslationVector();
+		const float translationScale = std::max({ 1.0f, glm::length(firstTranslation), glm::length(secondTranslation) });
+
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				if (std::abs(firstRotation[i][j] - secondRotation[i][j]) > DUPLICATE_TOLERANCE)
+					return false;
+			}
+
+			if (std::abs(firstTranslation[i] - secondTranslation[i]) > DUPLICATE_TOLERANCE * translationScale)
+				return false;
+		}
+
+		return true;
+	}
+
+	PairedCloudScatter GetPairedCloudScatter(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, bool parallel)
+	{
+		struct PairSums
+		{
+			Eigen::Vector3d sumBefore = Eigen::Vector3d::Zero();
+			Eigen::Vector3d sumAfter = Eigen::Vector3d::Zero();
+			Eigen::Matrix3d outerBefore = Eigen::Matrix3d::Zero();
+			Eigen::Matrix3d outerAfter = Eigen::Matrix3d::Zero();
+			// Sums over pairs, outerCross is sum of after * before^T
+			Eigen::Vector3d pairSumBefore = Eigen::Vector3d::Zero();
+			Eigen::Vector3d pairSumAfter = Eigen::Vector3d::Zero();
+			Eigen::Matrix3d outerCross = Eigen::Matrix3d::Zero();
+			double pairSquaredBefore = 0.0;
+			double pairSquaredAfter = 0.0;
+
+			void Merge(const PairSums& other)
 			{
-				results.insert(results.begin() + i, newResult);
-				if (results.size() > desiredLength)
+				sumBefore += other.sumBefore;
+				sumAfter += other.sumAfter;
+				outerBefore += other.outerBefore;
+				outerAfter += other.outerAfter;
+				pairSumBefore += other.pairSumBefore;
+				pairSumAfter += other.pairSumAfter;
+				outerCross += other.outerCross;
+				pairSquaredBefore += other.pairSquaredBefore;
+				pairSquaredAfter += other.pairSquaredAfter;
+			}
+		};
+
+		const int sizeBefore = static_cast<int>(cloudBefore.size());
+		const int sizeAfter = static_cast<int>(cloudAfter.size());
+		const int count = std::min(sizeBefore, sizeAfter);
+		std::array<PairSums, ACCUMULATOR_CHUNKS> partials;
+
+		AccumulateChunks(std::max(sizeBefore, sizeAfter), parallel, [&](int chunk, int begin, int end) {
+			PairSums sums;
+			for (int i = begin; i < end; i++)
+			{
+				const Eigen::Vector3d before = i < sizeBefore ? Eigen::Vector3d(cloudBefore[i].x, cloudBefore[i].y, cloudBefore[i].z) : Eigen::Vector3d::Zero();
+				const Eigen::Vector3d after = i < sizeAfter ? Eigen::Vector3d(cloudAfter[i].x, cloudAfter[i].y, cloudAfter[i].z) : Eigen::Vector3d::Zero();
+				sums.sumBefore += before;
+				sums.sumAfter += after;
+				sums.outerBefore.noalias() += before * before.transpose();
+				sums.outerAfter.noalias() += after * after.transpose();
+
+				if (i < count)
 				{
-					results.resize(desiredLength);
-					return;
+					sums.pairSumBefore += before;
+					sums.pairSumAfter += after;
+					sums.outerCross.noalias() += after * before.transpose();
+					sums.pairSquaredBefore += before.squaredNorm();
+					sums.pairSquaredAfter += after.squaredNorm();
 				}
 			}
-		}
+			partials[chunk] = sums;
+		});
+
+		PairSums& total = partials[0];
+		for (int chunk = 1; chunk < ACCUMULATOR_CHUNKS; chunk++)
+			total.Merge(partials[chunk]);
+
+		PairedCloudScatter result;
+		result.count = count;
+		const Eigen::Vector3d centerBefore = total.sumBefore / std::max(sizeBefore, 1);
+		const Eigen::Vector3d centerAfter = total.sumAfter / std::max(sizeAfter, 1);
+		result.before.center = centerBefore;
+		result.after.center = centerAfter;
+		result.before.scatter = total.outerBefore - sizeBefore * centerBefore * centerBefore.transpose();
+		result.after.scatter = total.outerAfter - sizeAfter * centerAfter * centerAfter.transpose();
+
+		// centers of whole clouds differ from centers of pairs, so all terms of the expansion remain
+		result.crossCovariance = total.outerCross - centerAfter * total.pairSumBefore.transpose() - total.pairSumAfter * centerBefore.transpose()
+			+ count * centerAfter * centerBefore.transpose();
+		result.pairVarianceBefore = total.pairSquaredBefore - 2.0 * centerBefore.dot(total.pairSumBefore) + count * centerBefore.squaredNorm();
+		result.pairVarianceAfter = total.pairSquaredAfter - 2.0 * centerAfter.dot(total.pairSumAfter) + count * centerAfter.squaredNorm();
+		return result;
+	}
+
+	Eigen::Matrix3f GetPrincipalAxes(const Eigen::Matrix3d& scatter)
+	{
+		// eigenvalues of the solver are increasing
+		const Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(scatter);
+		return solver.eigenvectors().rowwise().reverse().cast<float>();
 	}
 }
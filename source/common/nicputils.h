@@ -1,5 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
+#include <Eigen/Dense>
+
 #include "common.h"
 
 namespace Common
@@ -23,5 +27,65 @@ namespace Common
 		float approximatedError;
 	};
 
-	void StoreResultIfOptimal(std::vector<NonIterativeSlamResult>& results, const NonIterativeSlamResult& newResult, int desiredLength);
+	/// Bounded max-heap of NICP results with the smallest approximated error, filled concurrently by worker threads as soon as they finish.
+	/// Results are ordered by approximated error and then by repetition, so kept results do not depend on the order of pushes.
+	/// Of results with the same transformation only the best one is kept
+	class NonIterativeResultHeap
+	{
+	public:
+		struct Entry
+		{
+			NonIterativeSlamResult result;
+			int repetition;
+		};
+
+		explicit NonIterativeResultHeap(int capacity);
+
+		/// Results which cannot be kept are mostly rejected without taking the lock. A result with the transformation of a kept one
+		/// replaces it if it is better, and is rejected otherwise
+		/// \returns true if result is kept, it can still be pushed out by later results
+		bool Push(const NonIterativeSlamResult& result, int repetition);
+
+		/// Kept results sorted by ascending approximated error
+		std::vector<Entry> GetSorted() const;
+
+	private:
+		static bool IsBetter(const Entry& first, const Entry& second);
+		static bool IsSameTransformation(const NonIterativeSlamResult& first, const NonIterativeSlamResult& second);
+
+		const size_t capacity;
+		mutable std::mutex mutex;
+		// Worst kept entry on top
+		std::vector<Entry> entries;
+		// Approximated error of the worst kept entry once the heap is full
+		std::atomic<float> threshold;
+	};
+
+	struct CloudScatter
+	{
+		Eigen::Vector3d center;
+		/// Sum of (p - center) * (p - center)^T over points of the cloud
+		Eigen::Matrix3d scatter;
+	};
+
+	/// Scatter of two clouds and of pairs of their points with equal indices, centered at centers of whole clouds
+	struct PairedCloudScatter
+	{
+		CloudScatter before;
+		CloudScatter after;
+		/// Number of pairs, min(sizes)
+		int count = 0;
+		/// Sum of (after - centerAfter) * (before - centerBefore)^T over pairs
+		Eigen::Matrix3d crossCovariance;
+		/// Sums of |before - centerBefore|^2 and |after - centerAfter|^2 over pairs
+		double pairVarianceBefore = 0.0;
+		double pairVarianceAfter = 0.0;
+	};
+
+	/// Centers and scatter matrices from sums of points and of their outer products, gathered in one pass over both clouds in double precision.
+	/// Partial sums of fixed chunks are merged in order, so result is the same for parallel and sequential execution
+	PairedCloudScatter GetPairedCloudScatter(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, bool parallel);
+
+	/// Eigenvectors of the scatter matrix as columns, ordered by decreasing eigenvalue, each known only up to sign
+	Eigen::Matrix3f GetPrincipalAxes(const Eigen::Matrix3d& scatter);
 }
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "randomstream.h"
+
+namespace
+{
+	constexpr uint32_t PHILOX_MULTIPLIER_0 = 0xD2511F53;
+	constexpr uint32_t PHILOX_MULTIPLIER_1 = 0xCD9E8D57;
+	constexpr uint32_t PHILOX_WEYL_0 = 0x9E3779B9;
+	constexpr uint32_t PHILOX_WEYL_1 = 0xBB67AE85;
+	constexpr int PHILOX_ROUNDS = 10;
+
+	uint32_t randomSeed = 0;
+	Common::RandomStream defaultRandomStream = Common::RandomStream(0, Common::RandomPurpose::Default);
+}
+
+namespace Common
+{
+	RandomStream::RandomStream(uint32_t seed, RandomPurpose purpose, uint64_t taskIndex)
+		: key{ seed, static_cast<uint32_t>(purpose) },
+		counter{ 0, 0, static_cast<uint32_t>(taskIndex), static_cast<uint32_t>(taskIndex >> 32) },
+		block{},
+		position(block.size())
+	{
+	}
+
+	uint32_t RandomStream::NextUInt(uint32_t bound)
+	{
+		// Lemire's multiply and shift, draws are rejected only from the short biased range
+		uint64_t product = static_cast<uint64_t>(NextUInt()) * bound;
+		auto low = static_cast<uint32_t>(product);
+		if (low < bound)
+		{
+			const uint32_t threshold = (0u - bound) % bound;
+			while (low < threshold)
+			{
+				product = static_cast<uint64_t>(NextUInt()) * bound;
+				low = static_cast<uint32_t>(product);
+			}
+		}
+
+		return static_cast<uint32_t>(product >> 32);
+	}
+
+	void RandomStream::Refill()
+	{
+		auto state = counter;
+		auto roundKey = key;
+		for (int round = 0; round < PHILOX_ROUNDS; round++)
+		{
+			const uint64_t product0 = static_cast<uint64_t>(PHILOX_MULTIPLIER_0) * state[0];
+			const uint64_t product1 = static_cast<uint64_t>(PHILOX_MULTIPLIER_1) * state[2];
+			state = {
+				static_cast<uint32_t>(product1 >> 32) ^ state[1] ^ roundKey[0],
+				static_cast<uint32_t>(product1),
+				static_cast<uint32_t>(product0 >> 32) ^ state[3] ^ roundKey[1],
+				static_cast<uint32_t>(product0)
+			};
+			roundKey[0] += PHILOX_WEYL_0;
+			roundKey[1] += PHILOX_WEYL_1;
+		}
+
+		block = state;
+		position = 0;
+
+		// first two words count blocks, last two hold task index
+		if (++counter[0] == 0)
+			counter[1]++;
+	}
+
+	void SetRandomSeed(uint32_t seed)
+	{
+		randomSeed = seed;
+		defaultRandomStream = RandomStream(seed, RandomPurpose::Default);
+	}
+
+	uint32_t GetRandomSeed()
+	{
+		return randomSeed;
+	}
+
+	RandomStream& GetDefaultRandomStream()
+	{
+		return defaultRandomStream;
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "_common.h"
+
+namespace Common
+{
+	/// Users of random numbers, every one of them gets separate streams, so adding draws in one place
+	/// does not change numbers generated in another
+	enum class RandomPurpose : uint32_t
+	{
+		Default,
+		CloudBefore,
+		CloudAfter,
+		Transformation,
+		NicpSubcloud,
+		NicpRepetition
+	};
+
+	/// Counter based generator (Philox4x32-10). Numbers are a function of seed, purpose, task index and position in the stream only,
+	/// so every task of a parallel loop can create its own stream without any shared state,
+	/// and results do not depend on thread count or scheduling
+	class RandomStream
+	{
+	public:
+		RandomStream(uint32_t seed, RandomPurpose purpose, uint64_t taskIndex = 0);
+
+		/// Uniformly distributed 32 bits
+		uint32_t NextUInt()
+		{
+			if (position == block.size())
+				Refill();
+
+			return block[position++];
+		}
+
+		/// Uniformly distributed integer in [0, bound), without modulo bias
+		uint32_t NextUInt(uint32_t bound);
+
+		/// Uniformly distributed float in [0, 1)
+		float NextFloat() { return static_cast<float>(NextUInt() >> 8) * (1.0f / (1u << 24)); }
+
+		/// Uniformly distributed float in [min, max)
+		float NextFloat(float min, float max) { return min + NextFloat() * (max - min); }
+
+	private:
+		void Refill();
+
+		std::array<uint32_t, 2> key;
+		std::array<uint32_t, 4> counter;
+		std::array<uint32_t, 4> block;
+		size_t position;
+	};
+
+	/// Sets seed of the run, all streams created with GetRandomSeed derive from it. Resets default stream
+	void SetRandomSeed(uint32_t seed);
+	uint32_t GetRandomSeed();
+
+	/// Stream used by functions that are not given one, only for sequential code, parallel code should create a stream per task
+	RandomStream& GetDefaultRandomStream();
+
+	/// Shuffles range in place with Fisher-Yates, unlike std::shuffle the order is the same for every standard library
+	template<typename Iterator>
+	void Shuffle(Iterator begin, Iterator end, RandomStream& random)
+	{
+		const auto size = static_cast<uint32_t>(std::distance(begin, end));
+		for (uint32_t i = size; i > 1; i--)
+			std::iter_swap(begin + (i - 1), begin + random.NextUInt(i));
+	}
+}
@@ -1,6 +1,7 @@
 #include "testrunner.h"
 #include "common.h"
 #include "timer.h"
+#include "threadpool.h"
 
 namespace Common
 {
@@ -44,6 +45,9 @@ namespace Common
 
 	void TestRunner::RunSingle(Configuration configuration)
 	{
+		const auto threadCount = configuration.ThreadCount.value_or(static_cast<int>(std::thread::hardware_concurrency()));
+		ThreadPool::GetInstance().Resize(threadCount, configuration.ThreadAffinity);
+
 		const auto [before, after] = GetCloudsFromConfig(configuration);
 
 		auto timer = Common::Timer();
@@ -107,7 +107,7 @@ namespace Common
             config.ExecutionPolicy = ExecutionPolicy::Sequential;
             config.ApproximationType = ApproximationType::Hybrid;
             config.NicpSubcloudSize = 1000;
-            config.NicpIterations = 64;
+            config.NicpIterations = 64; // cpu nicp stops after 4
             config.CpdWeight = 0.1f;
 
             configurations.push_back(config);
@@ -148,7 +148,7 @@ namespace Common
                 config.ApproximationType = method == ComputationMethod::Cpd ? ApproximationType::Hybrid : ApproximationType::None;
                 config.NicpSubcloudSize = 5000;
                 config.NicpBatchSize = 1;
-                config.NicpIterations = 16;
+                config.NicpIterations = 16; // cpu nicp stops after 4
                 config.CpdWeight = 0.1f;
                 config.CpdTolerance = 1e-4;
 
@@ -185,4 +185,47 @@ namespace Common
 
         return configurations;
     }
+
+    // Same clouds for every nearest neighbour method, compare time columns of the outputs to find the crossover point
+    std::vector<Configuration> GetNearestNeighbourTestSet(ComputationMethod method, NearestNeighbourMethod nearestNeighbourMethod)
+    {
+        std::vector<Configuration> configurations;
+
+        for (int i = 250; i <= 64000; i *= 2)
+        {
+            auto path = GetObjectWithMinSize(i);
+
+            Configuration config;
+            config.BeforePath = path;
+            config.AfterPath = path;
+            config.ComputationMethod = method;
+            config.MaxIterations = 20;
+            config.CloudSpread = 10.f;
+            config.MaxDistanceSquared = 10000.f;
+            config.TransformationParameters = std::make_pair(.2f, 10.f);
+            config.CloudBeforeResize = i;
+            config.CloudAfterResize = i;
+            config.RandomSeed = 0;
+            config.ExecutionPolicy = ExecutionPolicy::Parallel;
+            config.ApproximationType = ApproximationType::None;
+            config.NearestNeighbourMethod = nearestNeighbourMethod;
+
+            configurations.push_back(config);
+        }
+
+        return configurations;
+    }
+
+    // Small correspondence distance and transformation, so that voxel grid cells stay small and all three methods can be compared
+    std::vector<Configuration> GetLocalNearestNeighbourTestSet(ComputationMethod method, NearestNeighbourMethod nearestNeighbourMethod)
+    {
+        auto configurations = GetNearestNeighbourTestSet(method, nearestNeighbourMethod);
+        for (auto& config : configurations)
+        {
+            config.MaxDistanceSquared = 1.f;
+            config.TransformationParameters = std::make_pair(.1f, .5f);
+        }
+
+        return configurations;
+    }
 }
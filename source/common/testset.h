@@ -6,4 +6,6 @@ namespace Common
 	std::vector<Configuration> GetSizesTestSet(ComputationMethod method);
 	std::vector<Configuration> GetPerformanceTestSet(ComputationMethod method);
 	std::vector<Configuration> GetConvergenceTestSet(ComputationMethod method);
+	std::vector<Configuration> GetNearestNeighbourTestSet(ComputationMethod method, NearestNeighbourMethod nearestNeighbourMethod);
+	std::vector<Configuration> GetLocalNearestNeighbourTestSet(ComputationMethod method, NearestNeighbourMethod nearestNeighbourMethod);
 }
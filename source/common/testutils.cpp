@@ -1,36 +1,39 @@
+#include <filesystem>
+
 #include "testutils.h"
+#include "common.h"
+#include "cpdutils.h"
 
 namespace Tests
 {
 	// Generate random data
 	//
-	float GetRandomFloat(float min, float max)
+	float GetRandomFloat(float min, float max, Common::RandomStream& random)
 	{
-		float range = max - min;
-		return static_cast<float>(rand()) / RAND_MAX * range + min;
+		return random.NextFloat(min, max);
 	}
 
-	Point_f GetRandomPoint(const Point_f& min, const Point_f& max)
+	Point_f GetRandomPoint(const Point_f& min, const Point_f& max, Common::RandomStream& random)
 	{
 		return {
-			GetRandomFloat(min.x, max.x),
-			GetRandomFloat(min.y, max.y),
-			GetRandomFloat(min.z, max.z)
+			GetRandomFloat(min.x, max.x, random),
+			GetRandomFloat(min.y, max.y, random),
+			GetRandomFloat(min.z, max.z, random)
 		};
 	}
 
-	std::vector<Point_f> GetRandomPointCloud(const Point_f& corner, const Point_f& size, int count)
+	std::vector<Point_f> GetRandomPointCloud(const Point_f& corner, const Point_f& size, int count, Common::RandomStream& random)
 	{
 		std::vector<Point_f> result;
 		for (int i = 0; i < count; i++)
-			result.push_back(GetRandomPoint(corner, corner + size));
+			result.push_back(GetRandomPoint(corner, corner + size, random));
 		return result;
 	}
 
-	glm::mat4 GetRandomTransformMatrix(const Point_f& translationMin, const Point_f& translationMax, float rotationRadians)
+	glm::mat4 GetRandomTransformMatrix(const Point_f& translationMin, const Point_f& translationMax, float rotationRadians, Common::RandomStream& random)
 	{
-		const auto rotation = glm::mat4(GetRandomRotationMatrix(rotationRadians));
-		return glm::translate(rotation, glm::vec3(GetRandomPoint(translationMin, translationMax)));
+		const auto rotation = glm::mat4(GetRandomRotationMatrix(rotationRadians, random));
+		return glm::translate(rotation, glm::vec3(GetRandomPoint(translationMin, translationMax, random)));
 	}
 
 	glm::mat4 GetTranformMatrix(const Point_f& translation, const Point_f& rotationAxis, float rotationRadians)
@@ -39,16 +42,16 @@ namespace Tests
 		return glm::translate(rotation, glm::vec3(translation));
 	}
 
-	glm::mat3 GetRandomRotationMatrix(float rotationRadians)
+	glm::mat3 GetRandomRotationMatrix(float rotationRadians, Common::RandomStream& random)
 	{
-		const auto axis = glm::vec3(GetRandomPoint(Point_f::Zero(), Point_f::One()));
+		const auto axis = glm::vec3(GetRandomPoint(Point_f::Zero(), Point_f::One(), random));
 		const auto rotation = glm::rotate(glm::mat4(1.0f), rotationRadians, glm::normalize(axis));
 		return glm::mat3(rotation);
 	}
 
-	glm::vec3 GetRandomTranslationVector(float translation)
+	glm::vec3 GetRandomTranslationVector(float translation, Common::RandomStream& random)
 	{
-		const auto point = GetRandomPoint({ -1.f, -1.f, -1.f }, { 1.f, 1.f, 1.f });
+		const auto point = GetRandomPoint({ -1.f, -1.f, -1.f }, { 1.f, 1.f, 1.f }, random);
 		const auto normalized = point / point.Length();
 		return normalized * translation;
 	}
@@ -61,6 +64,45 @@ namespace Tests
 		return glm::mat3(rotation);
 	}
 
+	// Checks
+	//
+	bool CheckSigmaSquaredInitialisation(const std::string& directory, double tolerance)
+	{
+		std::vector<std::string> paths;
+		for (const auto& entry : std::filesystem::directory_iterator(directory))
+			if (entry.path().extension() == ".obj")
+				paths.push_back(entry.path().string());
+
+		std::vector<std::vector<Point_f>> clouds;
+		for (const auto& path : paths)
+			clouds.push_back(Common::LoadCloud(path));
+
+		int failed = 0;
+		for (int i = 0; i < clouds.size(); i++)
+		{
+			for (int j = 0; j < clouds.size(); j++)
+			{
+				double sum = 0.0;
+				for (const auto& before : clouds[i])
+					for (const auto& after : clouds[j])
+						sum += static_cast<double>((before - after).LengthSquared());
+
+				const double expected = sum / (Common::DIMENSION * static_cast<double>(clouds[i].size()) * clouds[j].size());
+				const double actual = CoherentPointDrift::CalculateSigmaSquared(clouds[i], clouds[j]);
+				const double relativeError = std::abs(actual - expected) / expected;
+
+				if (relativeError > tolerance)
+				{
+					printf("Sigma squared mismatch for %s and %s: %f instead of %f\n", paths[i].c_str(), paths[j].c_str(), actual, expected);
+					failed++;
+				}
+			}
+		}
+
+		printf("Sigma squared initialisation: %d of %zu cloud pairs within tolerance\n", static_cast<int>(clouds.size() * clouds.size()) - failed, clouds.size() * clouds.size());
+		return failed == 0;
+	}
+
 	void RunTestSet(const AcquireFunc& acquireFunc, const Common::SlamFunc& slamFunc, const std::string& name, const std::vector<Common::ComputationMethod>& methodsToRun)
 	{
 		static_assert(static_cast<int>(Common::ComputationMethod::Icp) == 0);
@@ -2,6 +2,7 @@
 
 #include "_common.h"
 #include "testrunner.h"
+#include "randomstream.h"
 
 namespace Common {
 	struct Configuration;
@@ -13,20 +14,27 @@ namespace Tests
 	using Point_f = Common::Point_f;
 	using AcquireFunc = std::function<std::vector<Common::Configuration>(Common::ComputationMethod)>;
 
-	// Generate random data
+	// Generate random data, default stream is reset by Common::SetRandomSeed
 	//
-	float GetRandomFloat(float min, float max);
-	Point_f GetRandomPoint(const Point_f& min, const Point_f& max);
-	std::vector<Point_f> GetRandomPointCloud(const Point_f& corner, const Point_f& size, int count);
-	glm::mat4 GetRandomTransformMatrix(const Point_f& translationMin, const Point_f& translationMax, float rotationRadians);
+	float GetRandomFloat(float min, float max, Common::RandomStream& random = Common::GetDefaultRandomStream());
+	Point_f GetRandomPoint(const Point_f& min, const Point_f& max, Common::RandomStream& random = Common::GetDefaultRandomStream());
+	std::vector<Point_f> GetRandomPointCloud(const Point_f& corner, const Point_f& size, int count, Common::RandomStream& random = Common::GetDefaultRandomStream());
+	glm::mat4 GetRandomTransformMatrix(const Point_f& translationMin, const Point_f& translationMax, float rotationRadians, Common::RandomStream& random = Common::GetDefaultRandomStream());
 	glm::mat4 GetTranformMatrix(const Point_f& translation, const Point_f& rotationAxis, float rotationRadians);
-	glm::mat3 GetRandomRotationMatrix(float rotationRadians);
-	glm::vec3 GetRandomTranslationVector(float translation);
+	glm::mat3 GetRandomRotationMatrix(float rotationRadians, Common::RandomStream& random = Common::GetDefaultRandomStream());
+	glm::vec3 GetRandomTranslationVector(float translation, Common::RandomStream& random = Common::GetDefaultRandomStream());
 
 	// Helpers
 	//
 	glm::mat3 GetRotationMatrix(const Point_f& rotationAxis, float rotationAngle);
 
+	// Checks
+	//
+	/// Compares closed form CPD sigma squared initialisation with brute force sum over all pairs of points,
+	/// for every pair of .obj clouds in given directory. Prints pairs exceeding relative tolerance
+	/// \returns true if all pairs are within tolerance
+	bool CheckSigmaSquaredInitialisation(const std::string& directory, double tolerance = 1e-5);
+
 	// Run test batches, empty metdhos vector means running all methods
 	//
 	void RunTestSet(const AcquireFunc& acquireFunc, const Common::SlamFunc& slamFunc, const std::string& name, const std::vector<Common::ComputationMethod>& methods = {});
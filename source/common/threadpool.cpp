@@ -0,0 +1,176 @@
+#include "threadpool.h"
+
+#ifdef _WIN32
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <pthread.h>
+#endif
+
+namespace
+{
+	// Set for pool workers and for threads currently distributing a loop, so that nested loops do not wait for busy workers
+	thread_local bool insideParallelLoop = false;
+
+	// Number of chunks every thread gets on average when grain size is not given
+	constexpr int CHUNKS_PER_THREAD = 8;
+}
+
+namespace Common
+{
+	ThreadPool& ThreadPool::GetInstance()
+	{
+		static ThreadPool instance;
+		return instance;
+	}
+
+	ThreadPool::ThreadPool()
+	{
+		const int threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		StartWorkers(threadCount - 1);
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		StopWorkers();
+	}
+
+	void ThreadPool::Resize(int threadCount, bool pinThreads)
+	{
+		threadCount = std::max(1, threadCount);
+		if (threadCount == GetThreadCount() && pinThreads == pinned)
+			return;
+
+		std::lock_guard<std::mutex> loopLock(loopMutex);
+		StopWorkers();
+		pinned = pinThreads;
+		StartWorkers(threadCount - 1);
+	}
+
+	void ThreadPool::RunParallelFor(int begin, int end, ChunkFunction chunkFunction, const void* function, int grainSize)
+	{
+		if (end <= begin)
+			return;
+
+		if (grainSize <= 0)
+			grainSize = std::max(1, (end - begin) / (CHUNKS_PER_THREAD * GetThreadCount()));
+
+		if (insideParallelLoop || workers.empty() || end - begin <= grainSize)
+		{
+			chunkFunction(function, begin, end);
+			return;
+		}
+
+		std::unique_lock<std::mutex> loopLock(loopMutex, std::try_to_lock);
+		if (!loopLock.owns_lock())
+		{
+			chunkFunction(function, begin, end);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			loopChunkFunction = chunkFunction;
+			loopFunction = function;
+			loopNext = begin;
+			loopEnd = end;
+			loopGrainSize = grainSize;
+			pendingWorkers = static_cast<int>(workers.size());
+			generation++;
+		}
+		wakeCondition.notify_all();
+
+		insideParallelLoop = true;
+		RunChunks();
+		insideParallelLoop = false;
+
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCondition.wait(lock, [this]() { return pendingWorkers == 0; });
+		loopChunkFunction = nullptr;
+		loopFunction = nullptr;
+	}
+
+	void ThreadPool::StartWorkers(int workerCount)
+	{
+		stopping = false;
+		for (int i = 0; i < workerCount; i++)
+		{
+			workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, generation));
+			if (pinned)
+				PinThread(workers.back(), i);
+		}
+	}
+
+	void ThreadPool::StopWorkers()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wakeCondition.notify_all();
+
+		for (auto& worker : workers)
+			worker.join();
+
+		workers.clear();
+	}
+
+	void ThreadPool::WorkerLoop(unsigned long long lastGeneration)
+	{
+		insideParallelLoop = true;
+
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeCondition.wait(lock, [this, lastGeneration]() { return stopping || generation != lastGeneration; });
+				if (stopping)
+					return;
+
+				lastGeneration = generation;
+			}
+
+			RunChunks();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--pendingWorkers == 0)
+				doneCondition.notify_one();
+		}
+	}
+
+	void ThreadPool::RunChunks()
+	{
+		while (true)
+		{
+			const int chunkBegin = loopNext.fetch_add(loopGrainSize);
+			if (chunkBegin >= loopEnd)
+				return;
+
+			loopChunkFunction(loopFunction, chunkBegin, std::min(chunkBegin + loopGrainSize, loopEnd));
+		}
+	}
+
+	void ThreadPool::PinThread(std::thread& thread, int workerIndex)
+	{
+		// Core 0 is left for the calling thread
+		const int coreCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		const int core = (workerIndex + 1) % coreCount;
+
+#ifdef _WIN32
+		// Affinity mask covers only the processor group of the process, threads on further cores are left unpinned
+		constexpr int maskBits = static_cast<int>(sizeof(DWORD_PTR) * 8);
+		if (core >= maskBits)
+			return;
+
+		SetThreadAffinityMask(thread.native_handle(), static_cast<DWORD_PTR>(1) << core);
+#else
+		if (core >= CPU_SETSIZE)
+			return;
+
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		CPU_SET(core, &cpuSet);
+		pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuSet);
+#endif
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include "_common.h"
+
+namespace Common
+{
+	/// Process-wide pool of worker threads, created once and shared by all parallel algorithms
+	class ThreadPool
+	{
+	public:
+		static ThreadPool& GetInstance();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		~ThreadPool();
+
+		/// Recreates workers if parameters changed
+		/// \param threadCount Number of threads taking part in parallel loops, including the calling thread
+		/// \param pinThreads Pins every worker thread to a single CPU core
+		void Resize(int threadCount, bool pinThreads = false);
+		int GetThreadCount() const { return static_cast<int>(workers.size()) + 1; }
+
+		/// Calls func(chunkBegin, chunkEnd) for consecutive chunks of [begin, end), chunks are taken dynamically by idle threads.
+		/// Calling thread takes part in the work, nested calls (from inside of func) run sequentially on the calling thread
+		/// \param grainSize Chunk length, 0 picks length giving a few chunks per thread
+		template<typename Function>
+		void ParallelFor(int begin, int end, const Function& func, int grainSize = 0)
+		{
+			// func is passed by address instead of wrapping it in std::function, so starting a loop never allocates
+			const auto call_chunk = [](const void* function, int chunkBegin, int chunkEnd) {
+				(*static_cast<const Function*>(function))(chunkBegin, chunkEnd);
+			};
+			RunParallelFor(begin, end, call_chunk, &func, grainSize);
+		}
+
+	private:
+		using ChunkFunction = void(*)(const void* function, int chunkBegin, int chunkEnd);
+
+		ThreadPool();
+
+		void RunParallelFor(int begin, int end, ChunkFunction chunkFunction, const void* function, int grainSize);
+
+		void StartWorkers(int workerCount);
+		void StopWorkers();
+		void WorkerLoop(unsigned long long lastGeneration);
+		void RunChunks();
+		void PinThread(std::thread& thread, int workerIndex);
+
+		std::vector<std::thread> workers;
+		bool pinned = false;
+
+		// Only one parallel loop is distributed to workers at a time, concurrent callers run sequentially
+		std::mutex loopMutex;
+
+		std::mutex mutex;
+		std::condition_variable wakeCondition;
+		std::condition_variable doneCondition;
+		bool stopping = false;
+		unsigned long long generation = 0;
+		int pendingWorkers = 0;
+
+		ChunkFunction loopChunkFunction = nullptr;
+		const void* loopFunction = nullptr;
+		std::atomic<int> loopNext{ 0 };
+		int loopEnd = 0;
+		int loopGrainSize = 1;
+	};
+}
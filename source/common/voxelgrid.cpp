@@ -0,0 +1,196 @@
+#include "voxelgrid.h"
+
+namespace
+{
+	// Every cell coordinate is stored on 21 bits of the cell key
+	constexpr int COORDINATE_BITS = 21;
+	constexpr long long COORDINATE_MASK = (1ll << COORDINATE_BITS) - 1;
+	constexpr int COORDINATE_OFFSET = 1 << (COORDINATE_BITS - 1);
+}
+
+namespace Common
+{
+	VoxelGrid::VoxelGrid(const std::vector<Point_f>& cloud, float cellSize)
+	{
+		Build(cloud, cellSize);
+	}
+
+	void VoxelGrid::Build(const std::vector<Point_f>& cloud, float cellSize)
+	{
+		// coordinates outside of 21 bits would wrap and merge distant cells, one cell is left for neighbours of the border cells
+		float maxCoordinate = 0.f;
+		for (const auto& point : cloud)
+			maxCoordinate = std::max({ maxCoordinate, std::abs(point.x), std::abs(point.y), std::abs(point.z) });
+
+		this->cellSize = std::max(cellSize, maxCoordinate / (COORDINATE_OFFSET - 2));
+		invertedCellSize = 1.f / this->cellSize;
+		points.resize(cloud.size());
+		indices.resize(cloud.size());
+		keys.resize(cloud.size());
+
+		std::transform(cloud.begin(), cloud.end(), keys.begin(), [this](const Point_f& p) {
+			return GetCellKey(GetCellCoordinate(p.x), GetCellCoordinate(p.y), GetCellCoordinate(p.z));
+		});
+
+		std::iota(indices.begin(), indices.end(), 0);
+		std::sort(indices.begin(), indices.end(), [this](int a, int b) { return keys[a] < keys[b]; });
+		std::transform(indices.begin(), indices.end(), points.begin(), [&cloud](int index) { return cloud[index]; });
+
+		// at most half of slots is used
+		size_t slotCount = 1;
+		while (slotCount < 2 * cloud.size())
+			slotCount *= 2;
+		cells.assign(slotCount, CellRange());
+
+		const int size = static_cast<int>(indices.size());
+		for (int i = 0; i < size; i++)
+		{
+			const auto key = keys[indices[i]];
+			if (i > 0 && key == keys[indices[i - 1]])
+				continue;
+
+			size_t slot = GetSlot(key);
+			while (cells[slot].key >= 0)
+				slot = (slot + 1) & (cells.size() - 1);
+
+			int end = i + 1;
+			while (end < size && keys[indices[end]] == key)
+				end++;
+
+			cells[slot] = { key, i, end };
+		}
+	}
+
+	int VoxelGrid::FindNearest(const Point_f& point, float maxDistanceSquared) const
+	{
+		const int cellX = GetCellCoordinate(point.x);
+		const int cellY = GetCellCoordinate(point.y);
+		const int cellZ = GetCellCoordinate(point.z);
+
+		int bestIndex = -1;
+		float bestDistance = maxDistanceSquared;
+
+		for (int x = cellX - 1; x <= cellX + 1; x++)
+		{
+			for (int y = cellY - 1; y <= cellY + 1; y++)
+			{
+				for (int z = cellZ - 1; z <= cellZ + 1; z++)
+				{
+					const auto cell = FindCell(GetCellKey(x, y, z));
+					if (cell == nullptr)
+						continue;
+
+					for (int i = cell->begin; i < cell->end; i++)
+					{
+						const float distance = (points[i] - point).LengthSquared();
+						if (distance < bestDistance)
+						{
+							bestDistance = distance;
+							bestIndex = i;
+						}
+					}
+				}
+			}
+		}
+
+		return bestIndex >= 0 ? indices[bestIndex] : -1;
+	}
+
+	void VoxelGrid::FindCandidates(const Point_f& point, std::vector<int>* result) const
+	{
+		const int cellX = GetCellCoordinate(point.x);
+		const int cellY = GetCellCoordinate(point.y);
+		const int cellZ = GetCellCoordinate(point.z);
+
+		for (int x = cellX - 1; x <= cellX + 1; x++)
+		{
+			for (int y = cellY - 1; y <= cellY + 1; y++)
+			{
+				for (int z = cellZ - 1; z <= cellZ + 1; z++)
+				{
+					const auto cell = FindCell(GetCellKey(x, y, z));
+					if (cell == nullptr)
+						continue;
+
+					result->insert(result->end(), indices.begin() + cell->begin, indices.begin() + cell->end);
+				}
+			}
+		}
+	}
+
+	std::vector<Point_f> VoxelGrid::GetCellCentroids() const
+	{
+		std::vector<Point_f> centroids;
+		const int size = static_cast<int>(points.size());
+		int begin = 0;
+		for (int i = 1; i <= size; i++)
+		{
+			if (i < size && keys[indices[i]] == keys[indices[begin]])
+				continue;
+
+			Point_f sum = Point_f::Zero();
+			for (int j = begin; j < i; j++)
+				sum += points[j];
+			centroids.push_back(sum / static_cast<float>(i - begin));
+			begin = i;
+		}
+
+		return centroids;
+	}
+
+	int VoxelGrid::CountCandidates(const Point_f& point) const
+	{
+		const int cellX = GetCellCoordinate(point.x);
+		const int cellY = GetCellCoordinate(point.y);
+		const int cellZ = GetCellCoordinate(point.z);
+
+		int count = 0;
+		for (int x = cellX - 1; x <= cellX + 1; x++)
+		{
+			for (int y = cellY - 1; y <= cellY + 1; y++)
+			{
+				for (int z = cellZ - 1; z <= cellZ + 1; z++)
+				{
+					const auto cell = FindCell(GetCellKey(x, y, z));
+					if (cell != nullptr)
+						count += cell->end - cell->begin;
+				}
+			}
+		}
+
+		return count;
+	}
+
+	long long VoxelGrid::GetCellKey(int x, int y, int z) const
+	{
+		const long long keyX = static_cast<long long>(x + COORDINATE_OFFSET) & COORDINATE_MASK;
+		const long long keyY = static_cast<long long>(y + COORDINATE_OFFSET) & COORDINATE_MASK;
+		const long long keyZ = static_cast<long long>(z + COORDINATE_OFFSET) & COORDINATE_MASK;
+		return (keyX << (2 * COORDINATE_BITS)) | (keyY << COORDINATE_BITS) | keyZ;
+	}
+
+	const VoxelGrid::CellRange* VoxelGrid::FindCell(long long key) const
+	{
+		if (cells.empty())
+			return nullptr;
+
+		for (size_t slot = GetSlot(key); cells[slot].key >= 0; slot = (slot + 1) & (cells.size() - 1))
+		{
+			if (cells[slot].key == key)
+				return &cells[slot];
+		}
+
+		return nullptr;
+	}
+
+	size_t VoxelGrid::GetSlot(long long key) const
+	{
+		// Fibonacci hashing, neighbouring cells differ only in low bits of every coordinate
+		return static_cast<size_t>((static_cast<unsigned long long>(key) * 0x9E3779B97F4A7C15ull) >> 32) & (cells.size() - 1);
+	}
+
+	int VoxelGrid::GetCellCoordinate(float value) const
+	{
+		return static_cast<int>(std::floor(value * invertedCellSize));
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <limits>
+
+#include "_common.h"
+
+namespace Common
+{
+	/// Uniform voxel hash grid over a point cloud. Nearest neighbour query only visits the 27 cells
+	/// around the query point, so it finds correspondences not further than cell size
+	class VoxelGrid
+	{
+	public:
+		VoxelGrid() = default;
+		VoxelGrid(const std::vector<Point_f>& cloud, float cellSize);
+
+		/// Indexes the cloud again, reusing memory of the previous one.
+		/// Cell coordinates are stored on 21 bits, so cell size is enlarged when the cloud would not fit in 2^21 cells along an axis
+		void Build(const std::vector<Point_f>& cloud, float cellSize);
+
+		/// Returns index of the closest point in the indexed cloud or -1 if no point is closer than maxDistanceSquared
+		/// Exact as long as maxDistanceSquared is not bigger than squared cell size
+		int FindNearest(const Point_f& point, float maxDistanceSquared = std::numeric_limits<float>::max()) const;
+
+		/// Appends indices of all points from the 27 cells around the query point, in no particular order.
+		/// Result contains every point not further than cell size, distances are left to the caller
+		void FindCandidates(const Point_f& point, std::vector<int>* result) const;
+		/// Returns number of indices FindCandidates would append
+		int CountCandidates(const Point_f& point) const;
+
+		/// Returns mean of points of every non-empty cell, cells ordered by their keys.
+		/// Uses the cell size after enlargement, see Build
+		std::vector<Point_f> GetCellCentroids() const;
+
+		float GetCellSize() const { return cellSize; }
+		int GetSize() const { return static_cast<int>(points.size()); }
+
+	private:
+		struct CellRange
+		{
+			long long key = -1;
+			int begin = 0;
+			int end = 0;
+		};
+
+		long long GetCellKey(int x, int y, int z) const;
+		/// Returns range of the cell or nullptr if the cell is empty
+		const CellRange* FindCell(long long key) const;
+		size_t GetSlot(long long key) const;
+		int GetCellCoordinate(float value) const;
+
+		float cellSize = 1.f;
+		float invertedCellSize = 1.f;
+
+		// Points sorted by cell, so that every cell covers continuous range
+		std::vector<Point_f> points;
+		// Index of every sorted point in the original cloud
+		std::vector<int> indices;
+		// Cell key of every point of the original cloud
+		std::vector<long long> keys;
+		// Hash table of non-empty cells with linear probing, size is a power of two, empty slots have negative key.
+		// Kept in a vector, so that building the grid again does not allocate
+		std::vector<CellRange> cells;
+	};
+}
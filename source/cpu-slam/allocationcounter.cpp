@@ -0,0 +1,65 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "allocationcounter.h"
+
+namespace
+{
+	std::atomic<long long> allocationCount{ 0 };
+}
+
+namespace Common
+{
+	long long GetAllocationCount()
+	{
+		return allocationCount.load(std::memory_order_relaxed);
+	}
+}
+
+#ifdef TEST
+namespace
+{
+	void* Allocate(std::size_t size)
+	{
+		allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+		void* memory = std::malloc(size == 0 ? 1 : size);
+		if (memory == nullptr)
+			throw std::bad_alloc();
+
+		return memory;
+	}
+}
+
+// Replacements of global allocation functions, nothrow and sized versions forward to these by default
+void* operator new(std::size_t size)
+{
+	return Allocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+	return Allocate(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+#endif
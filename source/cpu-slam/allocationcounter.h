@@ -0,0 +1,9 @@
+#pragma once
+
+namespace Common
+{
+	/// Number of global operator new calls since program start, counted by all threads.
+	/// Useful to check that a loop does not allocate: compare values before and after it.
+	/// Allocation functions are replaced only in TEST builds, otherwise it always returns 0
+	long long GetAllocationCount();
+}
@@ -1,9 +1,12 @@
 #include <Eigen/Dense>
 #include <chrono>
+#include <cmath>
 #include <limits>
 
 #include "basicicp.h"
 #include "configuration.h"
+#include "kdtree.h"
+#include "voxelgrid.h"
 
 using namespace Common;
 
@@ -17,37 +20,64 @@ namespace BasicICP
 			config.ExecutionPolicy.value() == Common::ExecutionPolicy::Parallel :
 			true;
 
-		return GetBasicICPTransformationMatrix(cloudBefore, cloudAfter, iterations, error, config.ConvergenceEpsilon, config.MaxDistanceSquared, maxIterations, parallel);
+		return GetBasicICPTransformationMatrix(cloudBefore, cloudAfter, iterations, error, config.ConvergenceEpsilon, config.MaxDistanceSquared, maxIterations, parallel, config.NearestNeighbourMethod);
 	}
 
-	std::pair<glm::mat3, glm::vec3> GetBasicICPTransformationMatrix(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, int* iterations, float* error, float eps, float maxDistanceSquared, int maxIterations, bool parallel)
+	std::pair<glm::mat3, glm::vec3> GetBasicICPTransformationMatrix(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, int* iterations, float* error, float eps, float maxDistanceSquared, int maxIterations, bool parallel, NearestNeighbourMethod nearestNeighbourMethod)
 	{
 		*iterations = 0;
 		*error = 1e5;
 		glm::mat3 rotationMatrix = glm::mat3(1.0f);
 		glm::vec3 translationVector = glm::vec3(0.0f);
-		std::tuple<std::vector<Point_f>, std::vector<Point_f>, std::vector<int>, std::vector<int>> correspondingPoints;
-		std::vector<Point_f> transformedCloud = cloudBefore;
+		Workspace workspace;
+		workspace.transformedCloud = cloudBefore;
+		workspace.nextTransformedCloud.resize(cloudBefore.size());
+		const auto& correspondences = workspace.correspondences;
+
+		// Grid needs a finite positive cell size, without distance limit every cell would hold the whole cloud
+		if (nearestNeighbourMethod == NearestNeighbourMethod::VoxelGrid && !(std::isfinite(maxDistanceSquared) && maxDistanceSquared > 0.0f))
+		{
+			printf("Voxel grid needs finite positive max distance squared, got %f, using kd-tree\n", maxDistanceSquared);
+			nearestNeighbourMethod = NearestNeighbourMethod::KdTree;
+		}
+
+		// cloudAfter does not move, so its index is built once and reused in every iteration
+		const KdTree cloudAfterIndex = nearestNeighbourMethod == NearestNeighbourMethod::KdTree ? KdTree(cloudAfter) : KdTree();
+		// Grid cells are as big as the max correspondence distance, so points without partner are rejected after visiting 27 cells
+		const VoxelGrid cloudAfterGrid = nearestNeighbourMethod == NearestNeighbourMethod::VoxelGrid ? VoxelGrid(cloudAfter, std::sqrt(maxDistanceSquared)) : VoxelGrid();
+
+		const auto get_corresponding_indices = [&](const std::vector<Point_f>& cloud) {
+			switch (nearestNeighbourMethod)
+			{
+			case NearestNeighbourMethod::KdTree:
+				return GetCorrespondingIndices(cloud, cloudAfter, cloudAfterIndex, maxDistanceSquared, parallel, &workspace.correspondences);
+			case NearestNeighbourMethod::VoxelGrid:
+				return GetCorrespondingIndices(cloud, cloudAfter, cloudAfterGrid, maxDistanceSquared, parallel, &workspace.correspondences);
+			default:
+				return GetCorrespondingIndices(cloud, cloudAfter, maxDistanceSquared, parallel, &workspace.correspondences);
+			}
+		};
 
 		while (maxIterations == -1  || *iterations < maxIterations)
 		{
 			// get corresponding points
-			correspondingPoints = GetCorrespondingPoints(transformedCloud, cloudAfter, maxDistanceSquared, parallel);
-			if (std::get<0>(correspondingPoints).size() == 0)
+			get_corresponding_indices(workspace.transformedCloud);
+			if (correspondences.indexesBefore.size() == 0)
 				break;
 
 			// use svd
-			auto transformationMatrix = LeastSquaresSVD(std::get<0>(correspondingPoints), std::get<1>(correspondingPoints));
+			auto transformationMatrix = LeastSquaresSVD(workspace.transformedCloud, cloudAfter, correspondences.indexesBefore, correspondences.indexesAfter, parallel);
 
 			// update rotation matrix and translation vector
 			rotationMatrix = transformationMatrix.first * rotationMatrix;
 			translationVector = transformationMatrix.second + translationVector;
 
-			transformedCloud = GetTransformedCloud(cloudBefore, rotationMatrix, translationVector);
+			TransformCloud(cloudBefore, rotationMatrix, translationVector, &workspace.nextTransformedCloud);
+			std::swap(workspace.transformedCloud, workspace.nextTransformedCloud);
 			// count error
-			*error = GetMeanSquaredError(transformedCloud, cloudAfter, std::get<2>(correspondingPoints), std::get<3>(correspondingPoints));
+			*error = GetMeanSquaredError(workspace.transformedCloud, cloudAfter, correspondences.indexesBefore, correspondences.indexesAfter);
 
-			printf("loop_nr %d, error: %f, correspondencesSize: %zd\n", *iterations, *error, std::get<2>(correspondingPoints).size());
+			printf("loop_nr %d, error: %f, correspondencesSize: %zu\n", *iterations, *error, correspondences.indexesBefore.size());
 
 			if (*error < eps)
 			{
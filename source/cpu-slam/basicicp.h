@@ -9,6 +9,15 @@ namespace Common {
 
 namespace BasicICP
 {
+	/// Buffers reused between ICP iterations, after the first iteration no memory is allocated
+	struct Workspace
+	{
+		Common::CorrespondingIndices correspondences;
+		/// Cloud before transformed by the current estimate and its back buffer for the next estimate
+		std::vector<Common::Point_f> transformedCloud;
+		std::vector<Common::Point_f> nextTransformedCloud;
+	};
+
 	std::pair<glm::mat3, glm::vec3> CalculateICPWithConfiguration(const std::vector<Common::Point_f>& cloudBefore, const std::vector<Common::Point_f>& cloudAfter, Common::Configuration config, int* iterations, float* error);
-	std::pair<glm::mat3, glm::vec3> GetBasicICPTransformationMatrix(const std::vector<Common::Point_f>& cloudBefore, const std::vector<Common::Point_f>& cloudAfter, int* iterations, float* error, float eps, float maxDistanceSquared, int maxIterations = -1, bool parallel = true);
+	std::pair<glm::mat3, glm::vec3> GetBasicICPTransformationMatrix(const std::vector<Common::Point_f>& cloudBefore, const std::vector<Common::Point_f>& cloudAfter, int* iterations, float* error, float eps, float maxDistanceSquared, int maxIterations = -1, bool parallel = true, Common::NearestNeighbourMethod nearestNeighbourMethod = Common::NearestNeighbourMethod::KdTree);
 }
@@ -5,15 +5,55 @@
 #include "fgt.h"
 #include "fgt_model.h"
 #include "configuration.h"
-#include "cpdutils.h"
+#include "kabsch.h"
+#include "threadpool.h"
 
 using namespace Common;
 using namespace FastGaussTransform;
 
+namespace
+{
+	// Truncated E-step scans all pairs with the vectorized kernel when a target has on average more candidates
+	// in the grid than this fraction of the cloud, gathering candidates costs about four times more per pair
+	constexpr float MAX_CANDIDATE_FRACTION = 0.25f;
+
+	// Mean of a cloud and root of mean squared distance from it, non-rigid CPD registers clouds moved to zero mean and unit variance
+	struct CloudNormalisation
+	{
+		Point_f mean;
+		float scale;
+	};
+
+	// E-steps split cloudAfter into this many blocks with their own partial sums, independent of thread count,
+	// so that p1, px and error are the same on every machine and for sequential execution
+	constexpr int E_STEP_BLOCKS = 16;
+
+	// Calls compute_block(block) for every block, on the thread pool if parallel
+	template<typename ComputeBlock>
+	void ForEachBlock(int blockCount, bool parallel, const ComputeBlock& compute_block)
+	{
+		const auto compute_blocks = [&](int beginBlock, int endBlock) {
+			for (int block = beginBlock; block < endBlock; block++)
+				compute_block(block);
+		};
+
+		if (parallel)
+			Common::ThreadPool::GetInstance().ParallelFor(0, blockCount, compute_blocks, 1);
+		else
+			compute_blocks(0, blockCount);
+	}
+
+	// Multi-resolution CPD starts the next level with sigma not smaller than this fraction of the previous voxel size
+	constexpr float LEVEL_SIGMA_FLOOR_FACTOR = 0.5f;
+
+	// Full FGT approximation does not let sigma squared of rigid CPD drop below this. Non-rigid CPD registers normalised clouds
+	// and has no floor, FGT of its shrinking sigma stays as accurate as the exact E-step
+	constexpr float MIN_FGT_SIGMA_SQUARED = 0.05f;
+}
+
 namespace CoherentPointDrift
 {
-	float CalculateSigmaSquared(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter);
-	Probabilities ComputePMatrixFast(
+	void ComputePMatrixFast(
 		const std::vector<Point_f>& cloudTransformed,
 		const std::vector<Point_f>& cloudAfter,
 		const float& constant,
@@ -22,23 +62,58 @@ namespace CoherentPointDrift
 		const float& sigmaSquaredInit,
 		const ApproximationType& fgt,
 		const float& ratioOfFarField,
-		const float& orderOfTruncation);
-	Probabilities ComputePMatrix(
+		const float& orderOfTruncation,
+		const float& fgtErrorTolerance,
+		float minSigmaSquared,
+		bool parallel,
+		Workspace* workspace);
+	void ComputePMatrixTruncated(
+		const std::vector<Point_f>& cloudTransformed,
+		const std::vector<Point_f>& cloudAfter,
+		const float& constant,
+		const float& sigmaSquared,
+		const float& cutoff,
+		bool parallel,
+		Workspace* workspace);
+	void BuildSparsePMatrix(
 		const std::vector<Point_f>& cloudTransformed,
 		const std::vector<Point_f>& cloudAfter,
+		const float& sigmaSquared,
+		const float& cutoff,
+		int blockCount,
+		bool parallel,
+		Workspace* workspace);
+	void ComputePMatrixFromSparse(
+		const SparsePMatrix& sparsePMatrix,
+		const std::vector<Point_f>& cloudAfter,
+		int M,
 		const float& constant,
 		const float& sigmaSquared,
-		const bool& doTruncate = false,
-		float truncate = -1.0f);
+		int blockCount,
+		bool parallel,
+		Workspace* workspace);
+	void ReducePartialProbabilities(int blockCount, int M, int stride, const float& sigmaSquared, Workspace* workspace);
 	void MStep(
 		const std::vector<Point_f>& cloudBefore,
-		const std::vector<Point_f>& cloudAfter,
 		const Probabilities& probabilities,
+		const Eigen::VectorXd& afterSquaredNorms,
 		bool const_scale,
+		bool parallel,
 		glm::mat3* rotationMatrix,
 		glm::vec3* translationVector,
 		float* scale,
 		float* sigmaSquared);
+	CloudNormalisation GetNormalisation(const std::vector<Point_f>& cloud);
+	std::vector<Point_f> NormaliseCloud(const std::vector<Point_f>& cloud, const CloudNormalisation& normalisation);
+	void NonRigidMStep(
+		const Eigen::MatrixXd& cloudBefore,
+		const Probabilities& probabilities,
+		const Eigen::VectorXd& afterSquaredNorms,
+		const LowRankKernel& kernel,
+		float lambda,
+		Eigen::MatrixXd* transformedCloud,
+		Eigen::MatrixXd* projectedW,
+		float* sigmaSquared);
 
 	std::pair<glm::mat3, glm::vec3> CalculateCpdWithConfiguration(
 		const std::vector<Common::Point_f>& cloudBefore,
@@ -49,6 +124,10 @@ namespace CoherentPointDrift
 	{
 		auto maxIterations = config.MaxIterations.has_value() ? config.MaxIterations.value() : -1;
 
+		auto parallel = config.ExecutionPolicy.has_value() ?
+			config.ExecutionPolicy.value() == Common::ExecutionPolicy::Parallel :
+			true;
+
 		return GetRigidCPDTransformationMatrix(
 			cloudBefore,
 			cloudAfter,
@@ -61,7 +140,48 @@ namespace CoherentPointDrift
 			config.CpdTolerance,
 			config.ApproximationType,
 			config.RatioOfFarField,
-			config.OrderOfTruncation);
+			config.OrderOfTruncation,
+			config.FgtErrorTolerance.value_or(0.0f),
+			config.CpdSparsePMatrix,
+			config.CpdLevels,
+			parallel);
+	}
+
+	std::pair<glm::mat3, glm::vec3> CalculateNonRigidCpdWithConfiguration(
+		const std::vector<Common::Point_f>& cloudBefore,
+		const std::vector<Common::Point_f>& cloudAfter,
+		Common::Configuration config,
+		int* iterations,
+		float* error)
+	{
+		auto maxIterations = config.MaxIterations.has_value() ? config.MaxIterations.value() : -1;
+
+		auto parallel = config.ExecutionPolicy.has_value() ?
+			config.ExecutionPolicy.value() == Common::ExecutionPolicy::Parallel :
+			true;
+
+		const auto deformedCloud = GetNonRigidCPDTransformation(
+			cloudBefore,
+			cloudAfter,
+			iterations,
+			error,
+			config.ConvergenceEpsilon,
+			config.CpdWeight,
+			maxIterations,
+			config.CpdTolerance,
+			config.CpdBeta,
+			config.CpdLambda,
+			config.CpdKernelRank,
+			config.ApproximationType,
+			config.RatioOfFarField,
+			config.OrderOfTruncation,
+			config.FgtErrorTolerance.value_or(0.0f),
+			parallel);
+
+		const auto accumulator = AccumulatePairs(static_cast<int>(cloudBefore.size()), parallel, [&](KabschAccumulator* partial, int m) {
+			partial->Add(cloudBefore[m], deformedCloud[m]);
+		});
+		return accumulator.GetTransformation();
 	}
 
 	//[0, 1, 2] if > 0, then use FGT. case 1: FGT with fixing sigma after it gets too small(faster, but the result can be rough)
@@ -78,7 +198,11 @@ namespace CoherentPointDrift
 		float tolerance,
 		ApproximationType fgt,
 		const float& ratioOfFarField,
-		const float& orderOfTruncation)
+		const float& orderOfTruncation,
+		const float& fgtErrorTolerance,
+		bool sparsePMatrix,
+		const std::vector<CpdLevel>& levels,
+		bool parallel)
 	{
 		*iterations = 0;
 		*error = 1e5;
@@ -93,52 +217,221 @@ namespace CoherentPointDrift
 		if (weight >= 1.0f)
 			weight = 1.0f - 1e-6f;
 
-		const float constant = (std::pow(2 * M_PI * sigmaSquared, (float)DIMENSION * 0.5f) * weight * cloudBefore.size()) / ((1 - weight) * cloudAfter.size());
+		// runs EM on one level of resolution starting from current parameters
+		const auto run_em = [&](const std::vector<Point_f>& levelBefore, const std::vector<Point_f>& levelAfter, int levelMaxIterations) {
+			const float constant = (std::pow(2 * M_PI * sigmaSquared_init, (float)DIMENSION * 0.5f) * weight * levelBefore.size()) / ((1 - weight) * levelAfter.size());
+			float ntol = tolerance + 10.0f;
+			float l = 0.0f;
+			int levelIterations = 0;
+
+			Workspace workspace;
+			workspace.useSparsePMatrix = sparsePMatrix;
+			TransformCloud(levelBefore, rotationMatrix, translationVector, scale, &workspace.transformedCloud);
+			workspace.afterSquaredNorms.resize(levelAfter.size());
+			for (int n = 0; n < static_cast<int>(levelAfter.size()); n++)
+				workspace.afterSquaredNorms(n) = levelAfter[n].LengthSquared();
+			const auto& probabilities = workspace.probabilities;
+
+			//EM optimization
+			while (levelIterations < levelMaxIterations && ntol > tolerance && sigmaSquared > eps)
+			{
+				//E-step
+				if (fgt == ApproximationType::None)
+					ComputePMatrix(workspace.transformedCloud, levelAfter, constant, sigmaSquared, parallel, &workspace);
+				else
+					ComputePMatrixFast(workspace.transformedCloud, levelAfter, constant, weight, &sigmaSquared, sigmaSquared_init, fgt, ratioOfFarField, orderOfTruncation, fgtErrorTolerance, MIN_FGT_SIGMA_SQUARED, parallel, &workspace);
+
+				ntol = std::abs((probabilities.error - l) / probabilities.error);
+				l = probabilities.error;
+
+				//M-step
+				MStep(levelBefore, probabilities, workspace.afterSquaredNorms, const_scale, parallel, &rotationMatrix, &translationVector, &scale, &sigmaSquared);
+
+				TransformCloud(levelBefore, rotationMatrix, translationVector, scale, &workspace.transformedCloud);
+				(*error) = sigmaSquared;
+				(*iterations)++;
+				levelIterations++;
+				printf("loop_nr %d, error: %f\n", *iterations, *error);
+			}
+		};
+
+		// coarse levels work on centroids of voxels, every level starts from rotation, translation, scale and sigma squared of the previous one
+		for (const auto& level : levels)
+		{
+			const auto levelBefore = VoxelGrid(cloudBefore, level.VoxelSize).GetCellCentroids();
+			const auto levelAfter = VoxelGrid(cloudAfter, level.VoxelSize).GetCellCentroids();
+			printf("cpd level, voxel size: %f, points before: %zu, points after: %zu\n", level.VoxelSize, levelBefore.size(), levelAfter.size());
+			run_em(levelBefore, levelAfter, level.Iterations);
+
+			// centroids are displaced by up to half a voxel, smaller sigma squared of a coarse level is not reliable
+			// and would make the next level start below eps
+			const float halfVoxel = level.VoxelSize * LEVEL_SIGMA_FLOOR_FACTOR;
+			sigmaSquared = std::max(sigmaSquared, halfVoxel * halfVoxel);
+		}
+
+		run_em(cloudBefore, cloudAfter, maxIterations);
+		return std::make_pair(scale * rotationMatrix, translationVector);
+	}
+
+	std::vector<Point_f> GetNonRigidCPDTransformation(
+		const std::vector<Point_f>& cloudBefore,
+		const std::vector<Point_f>& cloudAfter,
+		int* iterations,
+		float* error,
+		float eps,
+		float weight,
+		int maxIterations,
+		float tolerance,
+		float beta,
+		float lambda,
+		int kernelRank,
+		ApproximationType fgt,
+		const float& ratioOfFarField,
+		const float& orderOfTruncation,
+		const float& fgtErrorTolerance,
+		bool parallel)
+	{
+		const int M = cloudBefore.size();
+		const int N = cloudAfter.size();
+		*iterations = 0;
+		*error = 1e5;
+
+		if (weight <= 0.0f)
+			weight = 1e-6f;
+		if (weight >= 1.0f)
+			weight = 1.0f - 1e-6f;
+
+		const CloudNormalisation normalisationBefore = GetNormalisation(cloudBefore);
+		const CloudNormalisation normalisationAfter = GetNormalisation(cloudAfter);
+		const auto normalisedBefore = NormaliseCloud(cloudBefore, normalisationBefore);
+		const auto normalisedAfter = NormaliseCloud(cloudAfter, normalisationAfter);
+
+		// eps and the reported error are sigma squared of the clouds, not of the normalised ones
+		const float scaleSquared = normalisationAfter.scale * normalisationAfter.scale;
+		const float normalisedEps = eps / scaleSquared;
+
+		float sigmaSquared = CalculateSigmaSquared(normalisedBefore, normalisedAfter);
+		const float sigmaSquared_init = sigmaSquared;
+		const float constant = (std::pow(2 * M_PI * sigmaSquared_init, (float)DIMENSION * 0.5f) * weight * M) / ((1 - weight) * N);
+
+		const LowRankKernel kernel = ComputeLowRankKernel(normalisedBefore, beta, kernelRank, fgtErrorTolerance > 0.0f ? fgtErrorTolerance : AUTO_ERROR_TOLERANCE, parallel);
+		printf("low-rank kernel rank: %d\n", static_cast<int>(kernel.eigenvalues.size()));
+
+		Eigen::MatrixXd before(M, DIMENSION);
+		for (int m = 0; m < M; m++)
+			before.row(m) << normalisedBefore[m].x, normalisedBefore[m].y, normalisedBefore[m].z;
+		Eigen::MatrixXd transformed = before;
+		// eigenvectors^T * W, displacement is eigenvectors * diag(eigenvalues) * projectedW
+		Eigen::MatrixXd projectedW = Eigen::MatrixXd::Zero(kernel.eigenvalues.size(), DIMENSION);
+
+		Workspace workspace;
+		workspace.transformedCloud = normalisedBefore;
+		workspace.afterSquaredNorms.resize(N);
+		for (int n = 0; n < N; n++)
+			workspace.afterSquaredNorms(n) = normalisedAfter[n].LengthSquared();
+		const auto& probabilities = workspace.probabilities;
+
 		float ntol = tolerance + 10.0f;
 		float l = 0.0f;
-		//TODO:
-		//initialize memory for probabilities once
-		Probabilities probabilities;
-		std::vector<Point_f> transformedCloud = cloudBefore;
+
 		//EM optimization
-		while (*iterations < maxIterations && ntol > tolerance && sigmaSquared > eps)
+		while (*iterations < maxIterations && ntol > tolerance && sigmaSquared > normalisedEps)
 		{
 			//E-step
 			if (fgt == ApproximationType::None)
-				probabilities = ComputePMatrix(transformedCloud, cloudAfter, constant, sigmaSquared);
+				ComputePMatrix(workspace.transformedCloud, normalisedAfter, constant, sigmaSquared, parallel, &workspace);
 			else
-				probabilities = ComputePMatrixFast(transformedCloud, cloudAfter, constant, weight, &sigmaSquared, sigmaSquared_init, fgt, ratioOfFarField, orderOfTruncation);
+				ComputePMatrixFast(workspace.transformedCloud, normalisedAfter, constant, weight, &sigmaSquared, sigmaSquared_init, fgt, ratioOfFarField, orderOfTruncation, fgtErrorTolerance, 0.0f, parallel, &workspace);
 
-			ntol = std::abs((probabilities.error - l) / probabilities.error);
-			l = probabilities.error;
+			// negative log-likelihood with the smoothness term lambda / 2 * trace(W^T * G * W)
+			const double regularisation = 0.5 * lambda * (projectedW.transpose() * kernel.eigenvalues.cast<double>().asDiagonal() * projectedW).trace();
+			const float objective = probabilities.error + static_cast<float>(regularisation);
+			ntol = std::abs((objective - l) / objective);
+			l = objective;
 
 			//M-step
-			MStep(cloudBefore, cloudAfter, probabilities, const_scale, &rotationMatrix, &translationVector, &scale, &sigmaSquared);
+			NonRigidMStep(before, probabilities, workspace.afterSquaredNorms, kernel, lambda, &transformed, &projectedW, &sigmaSquared);
+
+			for (int m = 0; m < M; m++)
+				workspace.transformedCloud[m] = Point_f(transformed(m, 0), transformed(m, 1), transformed(m, 2));
 
-			transformedCloud = GetTransformedCloud(cloudBefore, rotationMatrix, translationVector, scale);
-			(*error) = sigmaSquared;
+			(*error) = sigmaSquared * scaleSquared;
 			(*iterations)++;
 			printf("loop_nr %d, error: %f\n", *iterations, *error);
 		}
-		return std::make_pair(scale * rotationMatrix, translationVector);
+
+		// normalised cloudBefore was moved onto normalised cloudAfter
+		auto result = std::vector<Point_f>(M);
+		for (int m = 0; m < M; m++)
+			result[m] = workspace.transformedCloud[m] * normalisationAfter.scale + normalisationAfter.mean;
+		return result;
 	}
 
-	float CalculateSigmaSquared(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter)
+	// Solves (G + lambda * sigma^2 * d(P1)^-1) * W = d(P1)^-1 * P * X - Y with G = Q * L * Q^T replaced by its low-rank approximation.
+	// With the Woodbury identity only rank x rank systems are solved, W itself is not needed, only Q^T * W
+	void NonRigidMStep(
+		const Eigen::MatrixXd& cloudBefore,
+		const Probabilities& probabilities,
+		const Eigen::VectorXd& afterSquaredNorms,
+		const LowRankKernel& kernel,
+		float lambda,
+		Eigen::MatrixXd* transformedCloud,
+		Eigen::MatrixXd* projectedW,
+		float* sigmaSquared)
 	{
-		float sum = 0.0f;
-		for (size_t i = 0; i < cloudBefore.size(); i++)
-		{
-			for (size_t j = 0; j < cloudAfter.size(); j++)
-			{
-				const auto diff = cloudBefore[i] - cloudAfter[j];
-				sum += diff.LengthSquared();
-			}
-		}
-		sum /= (float)(DIMENSION * cloudBefore.size() * cloudAfter.size());
-		return sum;
+		const int M = cloudBefore.rows();
+		const Eigen::VectorXd p1 = probabilities.p1.head(M).cast<double>();
+		const Eigen::MatrixXd px = probabilities.px.topRows(M).cast<double>();
+		const Eigen::MatrixXd eigenvectors = kernel.eigenvectors.cast<double>();
+		const Eigen::VectorXd eigenvalues = kernel.eigenvalues.cast<double>();
+		const double Np = p1.sum();
+		const double lambdaSigmaSquared = lambda * (*sigmaSquared);
+
+		// right-hand side multiplied by d(P1), P * X - d(P1) * Y
+		const Eigen::MatrixXd projectedRhs = eigenvectors.transpose() * (px - p1.asDiagonal() * cloudBefore);
+		const Eigen::MatrixXd projectedP1 = eigenvectors.transpose() * (p1.asDiagonal() * eigenvectors);
+
+		// W = (rhs - d(P1) * Q * (lambda * sigma^2 * L^-1 + Q^T * d(P1) * Q)^-1 * Q^T * rhs) / (lambda * sigma^2)
+		Eigen::MatrixXd inner = projectedP1;
+		inner.diagonal() += lambdaSigmaSquared * eigenvalues.cwiseInverse();
+		const Eigen::MatrixXd solved = inner.ldlt().solve(projectedRhs);
+		*projectedW = (projectedRhs - projectedP1 * solved) / lambdaSigmaSquared;
+		*transformedCloud = cloudBefore + eigenvectors * (eigenvalues.asDiagonal() * (*projectedW));
+
+		// sum of P weighted squared distances between cloudAfter and transformed cloud, expanded
+		const double distances = probabilities.pt1.cast<double>().dot(afterSquaredNorms)
+			- 2.0 * px.cwiseProduct(*transformedCloud).sum()
+			+ p1.dot(transformedCloud->rowwise().squaredNorm());
+		*sigmaSquared = std::abs(distances) / (Np * DIMENSION);
+	}
+
+	CloudNormalisation GetNormalisation(const std::vector<Point_f>& cloud)
+	{
+		Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+		for (const auto& point : cloud)
+			sum += Eigen::Vector3d(point.x, point.y, point.z);
+		const Eigen::Vector3d mean = sum / static_cast<double>(cloud.size());
+
+		double squaredDistances = 0.0;
+		for (const auto& point : cloud)
+			squaredDistances += (Eigen::Vector3d(point.x, point.y, point.z) - mean).squaredNorm();
+
+		CloudNormalisation result;
+		result.mean = Point_f(mean.x(), mean.y(), mean.z());
+		result.scale = static_cast<float>(std::sqrt(squaredDistances / cloud.size()));
+		return result;
 	}
 
-	Probabilities ComputePMatrixFast(
+	std::vector<Point_f> NormaliseCloud(const std::vector<Point_f>& cloud, const CloudNormalisation& normalisation)
+	{
+		auto result = std::vector<Point_f>(cloud.size());
+		std::transform(cloud.begin(), cloud.end(), result.begin(), [&normalisation](const Point_f& point) {
+			return (point - normalisation.mean) / normalisation.scale;
+		});
+		return result;
+	}
+
+	void ComputePMatrixFast(
 		const std::vector<Point_f>& cloudTransformed,
 		const std::vector<Point_f>& cloudAfter,
 		const float& constant,
@@ -147,117 +440,356 @@ namespace CoherentPointDrift
 		const float& sigmaSquaredInit,
 		const ApproximationType& fgt,
 		const float& ratioOfFarField,
-		const float& orderOfTruncation)
+		const float& orderOfTruncation,
+		const float& fgtErrorTolerance,
+		float minSigmaSquared,
+		bool parallel,
+		Workspace* workspace)
 	{
 		if (fgt == ApproximationType::Full)
 		{
-			if (*sigmaSquared < 0.05)
-				*sigmaSquared = 0.05;
-			return ComputePMatrixWithFGT(cloudTransformed, cloudAfter, weight, *sigmaSquared, sigmaSquaredInit, ratioOfFarField, orderOfTruncation);
+			if (*sigmaSquared < minSigmaSquared)
+				*sigmaSquared = minSigmaSquared;
+			workspace->probabilities = ComputePMatrixWithFGT(cloudTransformed, cloudAfter, weight, *sigmaSquared, sigmaSquaredInit, ratioOfFarField, orderOfTruncation, fgtErrorTolerance, &workspace->fgtCache);
 		}
-		if (fgt == ApproximationType::Hybrid)
+		else if (fgt == ApproximationType::Hybrid)
 		{
 			if (*sigmaSquared > 0.015 * sigmaSquaredInit)
-				return ComputePMatrixWithFGT(cloudTransformed, cloudAfter, weight, *sigmaSquared, sigmaSquaredInit, ratioOfFarField, orderOfTruncation);
+				workspace->probabilities = ComputePMatrixWithFGT(cloudTransformed, cloudAfter, weight, *sigmaSquared, sigmaSquaredInit, ratioOfFarField, orderOfTruncation, fgtErrorTolerance, &workspace->fgtCache);
 			else
-				return ComputePMatrix(cloudTransformed, cloudAfter, constant, *sigmaSquared, true, 1e-3f);
+				ComputePMatrix(cloudTransformed, cloudAfter, constant, *sigmaSquared, parallel, workspace, true, 1e-3f);
+		}
+		else if (fgt == ApproximationType::Auto)
+		{
+			const float tolerance = fgtErrorTolerance > 0.0f ? fgtErrorTolerance : AUTO_ERROR_TOLERANCE;
+			// grid and FGT parameters used for the cost estimates are reused by the chosen E-step
+			FGTEStepParameters fgtParameters;
+			switch (ChooseEStepMethod(cloudTransformed, cloudAfter, *sigmaSquared, tolerance, &workspace->transformedGrid, &workspace->fgtCache, &fgtParameters))
+			{
+			case EStepMethod::FGT:
+				workspace->probabilities = ComputePMatrixWithFGT(cloudTransformed, cloudAfter, weight, *sigmaSquared, sigmaSquaredInit, ratioOfFarField, orderOfTruncation, tolerance, &workspace->fgtCache, &fgtParameters);
+				break;
+			case EStepMethod::Truncated:
+				ComputePMatrix(cloudTransformed, cloudAfter, constant, *sigmaSquared, parallel, workspace, true, tolerance, true);
+				break;
+			default:
+				ComputePMatrix(cloudTransformed, cloudAfter, constant, *sigmaSquared, parallel, workspace);
+				break;
+			}
 		}
-		return Probabilities();
 	}
 
-	Probabilities ComputePMatrix(
+	void ComputePMatrix(
 		const std::vector<Point_f>& cloudTransformed,
 		const std::vector<Point_f>& cloudAfter,
 		const float& constant,
 		const float& sigmaSquared,
+		bool parallel,
+		Workspace* workspace,
 		const bool& doTruncate,
-		float truncate)
+		float truncate,
+		bool gridBuilt)
 	{
 		const float multiplier = -0.5f / sigmaSquared;
-		Eigen::VectorXf p = Eigen::VectorXf::Zero(cloudTransformed.size());
-		Eigen::VectorXf p1 = Eigen::VectorXf::Zero(cloudTransformed.size());
-		Eigen::VectorXf pt1 = Eigen::VectorXf::Zero(cloudAfter.size());
-		Eigen::MatrixXf px = Eigen::MatrixXf::Zero(cloudTransformed.size(), DIMENSION);
-		float error = 0.0;
+		const int M = static_cast<int>(cloudTransformed.size());
+		const int N = static_cast<int>(cloudAfter.size());
+		const float cutoff = doTruncate ? std::max(std::log(truncate), MIN_EXP_ARGUMENT) : MIN_EXP_ARGUMENT;
+
 		if (doTruncate)
-			truncate = std::log(truncate);
+		{
+			// probabilities smaller than truncate are dropped, so only sources within the truncation radius of a target are visited
+			if (!gridBuilt)
+				workspace->transformedGrid.Build(cloudTransformed, GetTruncationRadius(sigmaSquared, truncate));
+			if (EstimateCandidateCount(workspace->transformedGrid, cloudAfter) < MAX_CANDIDATE_FRACTION * M)
+			{
+				ComputePMatrixTruncated(cloudTransformed, cloudAfter, constant, sigmaSquared, cutoff, parallel, workspace);
+				return;
+			}
+		}
+
+		auto& source = workspace->transformedSoa;
+		source.Assign(cloudTransformed);
+		const int paddedM = source.GetPaddedSize();
+
+		auto& probabilities = workspace->probabilities;
+		probabilities.pt1.resize(N);
+
+		// cloudAfter is split into a fixed number of continuous blocks. Every block sums its own p1, px and error,
+		// blocks are reduced in order afterwards, so the result does not depend on scheduling nor on thread count
+		const int blockCount = std::max(1, std::min(N, E_STEP_BLOCKS));
+		auto& partials = workspace->partials;
+		partials.resize(blockCount);
+
+		const auto compute_block = [&](int block) {
+			auto& partial = partials[block];
+			partial.p1.assign(paddedM, 0.0f);
+			partial.px.assign(DIMENSION * paddedM, 0.0f);
+			partial.error = 0.0f;
+
+			const int begin = static_cast<int>(static_cast<long long>(N) * block / blockCount);
+			const int end = static_cast<int>(static_cast<long long>(N) * (block + 1) / blockCount);
+
+			ComputeGaussKernelBlock(source, cloudAfter, begin, end, multiplier, constant, cutoff, probabilities.pt1.data(), partial.p1.data(), partial.px.data(), &partial.error);
+		};
 
-		for (size_t x = 0; x < cloudAfter.size(); x++)
+		ForEachBlock(blockCount, parallel, compute_block);
+
+		ReducePartialProbabilities(blockCount, M, paddedM, sigmaSquared, workspace);
+	}
+
+	void ComputePMatrixTruncated(
+		const std::vector<Point_f>& cloudTransformed,
+		const std::vector<Point_f>& cloudAfter,
+		const float& constant,
+		const float& sigmaSquared,
+		const float& cutoff,
+		bool parallel,
+		Workspace* workspace)
+	{
+		const float multiplier = -0.5f / sigmaSquared;
+		const int M = static_cast<int>(cloudTransformed.size());
+		const int N = static_cast<int>(cloudAfter.size());
+
+		// grid of cloudTransformed with cell size of the truncation radius, built by ComputePMatrix
+		const auto& grid = workspace->transformedGrid;
+
+		auto& probabilities = workspace->probabilities;
+		probabilities.pt1.resize(N);
+
+		const int blockCount = std::max(1, std::min(N, E_STEP_BLOCKS));
+		if (workspace->useSparsePMatrix)
 		{
-			float denominator = 0.0;
-			for (size_t k = 0; k < cloudTransformed.size(); k++)
+			BuildSparsePMatrix(cloudTransformed, cloudAfter, sigmaSquared, cutoff, blockCount, parallel, workspace);
+			ComputePMatrixFromSparse(workspace->sparsePMatrix, cloudAfter, M, constant, sigmaSquared, blockCount, parallel, workspace);
+			return;
+		}
+
+		auto& partials = workspace->partials;
+		partials.resize(blockCount);
+
+		const auto compute_block = [&](int block) {
+			thread_local std::vector<int> neighbours;
+			thread_local std::vector<float> values;
+
+			auto& partial = partials[block];
+			partial.p1.assign(M, 0.0f);
+			partial.px.assign(DIMENSION * M, 0.0f);
+			partial.error = 0.0f;
+
+			const int begin = static_cast<int>(static_cast<long long>(N) * block / blockCount);
+			const int end = static_cast<int>(static_cast<long long>(N) * (block + 1) / blockCount);
+
+			for (int n = begin; n < end; n++)
 			{
-				const auto diffPoint = cloudAfter[x] - cloudTransformed[k];
-				float index = multiplier * diffPoint.LengthSquared();
+				const Point_f& target = cloudAfter[n];
+				neighbours.clear();
+				grid.FindCandidates(target, &neighbours);
+				const int count = static_cast<int>(neighbours.size());
+				values.resize(count);
 
-				if (doTruncate && index < truncate)
+				float denominator = 0.0f;
+				for (int i = 0; i < count; i++)
 				{
-					p(k) = 0.0f;
+					const float argument = multiplier * (cloudTransformed[neighbours[i]] - target).LengthSquared();
+					values[i] = argument < cutoff ? 0.0f : ExpApproximation(argument);
+					denominator += values[i];
 				}
-				else
+				denominator += constant;
+
+				probabilities.pt1(n) = 1.0f - constant / denominator;
+				partial.error -= std::log(denominator);
+
+				const float inverseDenominator = 1.0f / denominator;
+				for (int i = 0; i < count; i++)
+				{
+					if (values[i] == 0.0f)
+						continue;
+
+					const int m = neighbours[i];
+					const float value = values[i] * inverseDenominator;
+					partial.p1[m] += value;
+					partial.px[m] += value * target.x;
+					partial.px[M + m] += value * target.y;
+					partial.px[2 * M + m] += value * target.z;
+				}
+			}
+		};
+
+		ForEachBlock(blockCount, parallel, compute_block);
+
+		ReducePartialProbabilities(blockCount, M, M, sigmaSquared, workspace);
+	}
+
+	void BuildSparsePMatrix(
+		const std::vector<Point_f>& cloudTransformed,
+		const std::vector<Point_f>& cloudAfter,
+		const float& sigmaSquared,
+		const float& cutoff,
+		int blockCount,
+		bool parallel,
+		Workspace* workspace)
+	{
+		const float multiplier = -0.5f / sigmaSquared;
+		const int N = static_cast<int>(cloudAfter.size());
+		const auto& grid = workspace->transformedGrid;
+
+		auto& sparse = workspace->sparsePMatrix;
+		auto& blocks = workspace->sparseBlocks;
+		sparse.rowOffsets.resize(N + 1);
+		blocks.resize(blockCount);
+
+		// every block keeps its rows in its own arrays and stores length of every row in rowOffsets[n + 1]
+		const auto compute_block = [&](int block) {
+			thread_local std::vector<int> neighbours;
+
+			auto& rows = blocks[block];
+			rows.columns.clear();
+			rows.values.clear();
+
+			const int begin = static_cast<int>(static_cast<long long>(N) * block / blockCount);
+			const int end = static_cast<int>(static_cast<long long>(N) * (block + 1) / blockCount);
+
+			for (int n = begin; n < end; n++)
+			{
+				const Point_f& target = cloudAfter[n];
+				neighbours.clear();
+				grid.FindCandidates(target, &neighbours);
+
+				const size_t rowBegin = rows.values.size();
+				for (int m : neighbours)
 				{
-					float value = std::exp(index);
-					p(k) = value;
-					denominator += value;
+					const float argument = multiplier * (cloudTransformed[m] - target).LengthSquared();
+					if (argument < cutoff)
+						continue;
+
+					rows.columns.push_back(m);
+					rows.values.push_back(ExpApproximation(argument));
 				}
+				sparse.rowOffsets[n + 1] = static_cast<int>(rows.values.size() - rowBegin);
 			}
-			denominator += constant;
+		};
+
+		ForEachBlock(blockCount, parallel, compute_block);
+
+		sparse.rowOffsets[0] = 0;
+		for (int n = 0; n < N; n++)
+			sparse.rowOffsets[n + 1] += sparse.rowOffsets[n];
+
+		sparse.columns.resize(sparse.rowOffsets[N]);
+		sparse.values.resize(sparse.rowOffsets[N]);
+
+		ForEachBlock(blockCount, parallel, [&](int block) {
+			const int offset = sparse.rowOffsets[static_cast<long long>(N) * block / blockCount];
+			std::copy(blocks[block].columns.begin(), blocks[block].columns.end(), sparse.columns.begin() + offset);
+			std::copy(blocks[block].values.begin(), blocks[block].values.end(), sparse.values.begin() + offset);
+		});
+	}
+
+	void ComputePMatrixFromSparse(
+		const SparsePMatrix& sparsePMatrix,
+		const std::vector<Point_f>& cloudAfter,
+		int M,
+		const float& constant,
+		const float& sigmaSquared,
+		int blockCount,
+		bool parallel,
+		Workspace* workspace)
+	{
+		const int N = static_cast<int>(cloudAfter.size());
+
+		auto& probabilities = workspace->probabilities;
+		probabilities.pt1.resize(N);
+
+		auto& partials = workspace->partials;
+		partials.resize(blockCount);
 
-			pt1(x) = 1.0f - constant / denominator;
-			for (size_t k = 0; k < cloudTransformed.size(); k++)
+		const auto compute_block = [&](int block) {
+			auto& partial = partials[block];
+			partial.p1.assign(M, 0.0f);
+			partial.px.assign(DIMENSION * M, 0.0f);
+			partial.error = 0.0f;
+
+			const int begin = static_cast<int>(static_cast<long long>(N) * block / blockCount);
+			const int end = static_cast<int>(static_cast<long long>(N) * (block + 1) / blockCount);
+
+			for (int n = begin; n < end; n++)
 			{
-				if (p(k) != 0.0f)
+				const int rowBegin = sparsePMatrix.rowOffsets[n];
+				const int rowEnd = sparsePMatrix.rowOffsets[n + 1];
+
+				float denominator = 0.0f;
+				for (int i = rowBegin; i < rowEnd; i++)
+					denominator += sparsePMatrix.values[i];
+				denominator += constant;
+
+				probabilities.pt1(n) = 1.0f - constant / denominator;
+				partial.error -= std::log(denominator);
+
+				const Point_f& target = cloudAfter[n];
+				const float inverseDenominator = 1.0f / denominator;
+				for (int i = rowBegin; i < rowEnd; i++)
 				{
-					float value = p(k) / denominator;
-					p1(k) += value;
-					px.row(k) += ConvertToEigenVector(cloudAfter[x]) * value;
+					const int m = sparsePMatrix.columns[i];
+					const float value = sparsePMatrix.values[i] * inverseDenominator;
+					partial.p1[m] += value;
+					partial.px[m] += value * target.x;
+					partial.px[M + m] += value * target.y;
+					partial.px[2 * M + m] += value * target.z;
 				}
 			}
-			error -= std::log(denominator);
-		}
-		error += DIMENSION * cloudAfter.size() * std::log(sigmaSquared) / 2.0f;
+		};
 
-		return { p1, pt1, px, error };
+		ForEachBlock(blockCount, parallel, compute_block);
+
+		ReducePartialProbabilities(blockCount, M, M, sigmaSquared, workspace);
+	}
+
+	// Sums partial results of blocks in order, px of every block has columns of length stride
+	void ReducePartialProbabilities(int blockCount, int M, int stride, const float& sigmaSquared, Workspace* workspace)
+	{
+		auto& probabilities = workspace->probabilities;
+		const auto& partials = workspace->partials;
+
+		probabilities.p1.setZero(M);
+		probabilities.px.setZero(M, DIMENSION);
+		probabilities.error = 0.0f;
+		for (int block = 0; block < blockCount; block++)
+		{
+			probabilities.p1 += Eigen::Map<const Eigen::VectorXf>(partials[block].p1.data(), M);
+			probabilities.px += Eigen::Map<const Eigen::MatrixXf, 0, Eigen::OuterStride<>>(partials[block].px.data(), M, DIMENSION, Eigen::OuterStride<>(stride));
+			probabilities.error += partials[block].error;
+		}
+		probabilities.error += DIMENSION * probabilities.pt1.size() * std::log(sigmaSquared) / 2.0f;
 	}
 
 	void MStep(
 		const std::vector<Point_f>& cloudBefore,
-		const std::vector<Point_f>& cloudAfter,
 		const Probabilities& probabilities,
+		const Eigen::VectorXd& afterSquaredNorms,
 		bool const_scale,
+		bool parallel,
 		glm::mat3* rotationMatrix,
 		glm::vec3* translationVector,
 		float* scale,
 		float* sigmaSquared)
 	{
-		const float Np = probabilities.p1.sum();
-		const float InvertedNp = 1.0f / Np;
-		auto EigenBefore = GetMatrix3XFromPointsVector(cloudBefore);
-		auto EigenAfterT = GetMatrix3XFromPointsVector(cloudAfter);
-		Eigen::Vector3f EigenCenterBefore = InvertedNp * EigenBefore * probabilities.p1;
-		Eigen::Vector3f EigenCenterAfter = InvertedNp * EigenAfterT * probabilities.pt1;		
-
-		const Eigen::MatrixXf AMatrix = (EigenBefore * probabilities.px).transpose() - Np * (EigenCenterAfter * EigenCenterBefore.transpose());
-
-		const Eigen::JacobiSVD<Eigen::MatrixXf> svd = Eigen::JacobiSVD<Eigen::MatrixXf>(AMatrix, Eigen::ComputeThinU | Eigen::ComputeThinV);
-
-		const Eigen::Matrix3f matrixU = svd.matrixU();
-		const Eigen::Matrix3f matrixV = svd.matrixV();
-		const Eigen::Matrix3f matrixVT = matrixV.transpose();
-
-		const Eigen::Matrix3f determinantMatrix = matrixU * matrixVT;
+		// Pairs (y_m, row m of P * X) weighted by p1_m give all sums of the M-step in one pass over cloudBefore
+		const auto accumulator = AccumulatePairs(static_cast<int>(cloudBefore.size()), parallel, [&](KabschAccumulator* partial, int m) {
+			partial->AddWeighted(cloudBefore[m], probabilities.px.row(m).transpose().cast<double>(), probabilities.p1(m));
+		});
 
-		const Eigen::Matrix3f diag = Eigen::DiagonalMatrix<float, 3>(1.0f, 1.0f, determinantMatrix.determinant());
+		const double Np = accumulator.GetWeight();
+		const double InvertedNp = 1.0 / Np;
+		const Eigen::Vector3d EigenCenterBefore = accumulator.GetCenterBefore();
+		const Eigen::Vector3d EigenCenterAfter = accumulator.GetCenterAfter();
 
-		const Eigen::Matrix3f EigenRotationMatrix = matrixU * diag * matrixVT;
+		const Eigen::Matrix3d EigenRotationMatrix = accumulator.GetRotation();
 
-		const Eigen::Matrix3f EigenScaleNumerator = svd.singularValues().asDiagonal() * diag;
+		// trace(R^T * A), equal to trace of singular values with the reflection correction
+		const double scaleNumerator = accumulator.GetCrossCovariance().cwiseProduct(EigenRotationMatrix).sum();
+		const double scaleDenominator = accumulator.GetVarianceBefore();
 
-		const float scaleNumerator = EigenScaleNumerator.trace();
-		const float sigmaSubtrahend = (EigenAfterT.transpose().array().pow(2) * probabilities.pt1.replicate(1, DIMENSION).array()).sum()
-			- Np * EigenCenterAfter.transpose() * EigenCenterAfter;
-		const float scaleDenominator = (EigenBefore.transpose().array().pow(2) * probabilities.p1.replicate(1, DIMENSION).array()).sum()
-			- Np * EigenCenterBefore.transpose() * EigenCenterBefore;
+		const double sigmaSubtrahend = probabilities.pt1.cast<double>().dot(afterSquaredNorms) - Np * EigenCenterAfter.squaredNorm();
 
 		if (const_scale == false)
 		{
@@ -269,10 +801,10 @@ namespace CoherentPointDrift
 			*sigmaSquared = (InvertedNp * std::abs(sigmaSubtrahend + scaleDenominator - 2 * scaleNumerator)) / (float)DIMENSION;
 		}
 
-		const Eigen::Vector3f EigenTranslationVector = EigenCenterAfter - (*scale) * EigenRotationMatrix * EigenCenterBefore;
+		const Eigen::Vector3f EigenTranslationVector = (EigenCenterAfter - (*scale) * EigenRotationMatrix * EigenCenterBefore).cast<float>();
 
 		*translationVector = ConvertTranslationVector(EigenTranslationVector);
 
-		*rotationMatrix = ConvertRotationMatrix(EigenRotationMatrix);
+		*rotationMatrix = ConvertRotationMatrix(EigenRotationMatrix.cast<float>());
 	}
 }
@@ -2,13 +2,75 @@
 #include <utility>
 #include <tuple>
 #include "common.h"
+#include "cpdutils.h"
+#include "gausskernel.h"
+#include "voxelgrid.h"
 
 namespace Common {
 	struct Configuration;
+	struct CpdLevel;
 }
 
 namespace CoherentPointDrift
 {
+	/// Sums of one thread's block of cloudAfter in the exact E-step
+	struct PartialProbabilities
+	{
+		std::vector<float> p1;
+		/// Column major, cloud size (padded for the exact E-step) x DIMENSION
+		std::vector<float> px;
+		float error = 0.0f;
+	};
+
+	/// Truncated P matrix in compressed sparse row format, one row for every point of cloudAfter.
+	/// Values are Gaussian kernels, a row divided by its sum plus the outlier constant gives posteriors of the point
+	struct SparsePMatrix
+	{
+		/// Row n covers [rowOffsets[n], rowOffsets[n + 1]) of columns and values
+		std::vector<int> rowOffsets;
+		/// Index of the point of the transformed cloud
+		std::vector<int> columns;
+		std::vector<float> values;
+
+		size_t GetNonZeroCount() const { return values.size(); }
+		size_t GetMemorySize() const { return rowOffsets.size() * sizeof(int) + columns.size() * sizeof(int) + values.size() * sizeof(float); }
+	};
+
+	/// Buffers reused between CPD iterations, after the first iteration exact E-step and M-step do not allocate memory
+	struct Workspace
+	{
+		Probabilities probabilities;
+		std::vector<PartialProbabilities> partials;
+		/// Cloud before transformed by the current estimate, and its copy in layout of the E-step kernel
+		std::vector<Common::Point_f> transformedCloud;
+		SoaCloud transformedSoa;
+		/// Index of the transformed cloud for the truncated E-step and its cost estimate
+		Common::VoxelGrid transformedGrid;
+		/// |x|^2 of every point of cloudAfter, so that the sigma squared term sum(pt1 * |x|^2) is a dot product
+		Eigen::VectorXd afterSquaredNorms;
+		FGTCache fgtCache;
+		/// Truncated E-step builds sparsePMatrix and derives probabilities from it, instead of summing them directly.
+		/// Not built when the grid finds too many candidates and all pairs are computed
+		bool useSparsePMatrix = false;
+		SparsePMatrix sparsePMatrix;
+		/// Rows computed by every block of cloudAfter before they are joined, only columns and values are used
+		std::vector<SparsePMatrix> sparseBlocks;
+	};
+
+	/// Exact E-step of cloudAfter against cloudTransformed, result in workspace->probabilities
+	/// \param doTruncate If true, probabilities smaller than truncate are dropped and only sources from grid cells around every target are visited
+	/// \param gridBuilt If true, workspace->transformedGrid already holds cloudTransformed with cells of the truncation radius
+	void ComputePMatrix(
+		const std::vector<Common::Point_f>& cloudTransformed,
+		const std::vector<Common::Point_f>& cloudAfter,
+		const float& constant,
+		const float& sigmaSquared,
+		bool parallel,
+		Workspace* workspace,
+		const bool& doTruncate = false,
+		float truncate = -1.0f,
+		bool gridBuilt = false);
+
 	std::pair<glm::mat3, glm::vec3> CalculateCpdWithConfiguration(
 		const std::vector<Common::Point_f>& cloudBefore,
 		const std::vector<Common::Point_f>& cloudAfter,
@@ -28,5 +90,39 @@ namespace CoherentPointDrift
 		float tolerance,
 		Common::ApproximationType fgt,
 		const float& ratioOfFarField,
-		const float& orderOfTruncation);
+		const float& orderOfTruncation,
+		const float& fgtErrorTolerance,
+		bool sparsePMatrix,
+		const std::vector<Common::CpdLevel>& levels,
+		bool parallel = true);
+
+	/// Registration methods return a rigid transformation, so the deformation is returned as the rigid transformation closest to it
+	std::pair<glm::mat3, glm::vec3> CalculateNonRigidCpdWithConfiguration(
+		const std::vector<Common::Point_f>& cloudBefore,
+		const std::vector<Common::Point_f>& cloudAfter,
+		Common::Configuration configuration,
+		int* iterations,
+		float* error);
+
+	/// Non-rigid (GRBF) CPD of Myronenko and Song. Every point of cloudBefore is moved by displacement G * W, where G is the Gaussian kernel matrix
+	/// of cloudBefore with width beta, approximated by its kernelRank largest eigenvalues, and lambda weights smoothness of the displacement.
+	/// Clouds are normalised to zero mean and unit variance, beta and lambda refer to the normalised clouds
+	/// \returns cloudBefore moved onto cloudAfter
+	std::vector<Common::Point_f> GetNonRigidCPDTransformation(
+		const std::vector<Common::Point_f>& cloudBefore,
+		const std::vector<Common::Point_f>& cloudAfter,
+		int* iterations,
+		float* error,
+		float eps,
+		float weight,
+		int maxIterations,
+		float tolerance,
+		float beta,
+		float lambda,
+		int kernelRank,
+		Common::ApproximationType fgt,
+		const float& ratioOfFarField,
+		const float& orderOfTruncation,
+		const float& fgtErrorTolerance,
+		bool parallel = true);
 }
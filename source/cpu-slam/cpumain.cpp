@@ -1,6 +1,7 @@
 #include "coherentpointdrift.h"
 #include "noniterative.h"
 #include "basicicp.h"
+#include "cputests.h"
 
 #include "mainwrapper.h"
 #include "common.h"
@@ -17,6 +18,8 @@ namespace {
 				return NonIterative::CalculateNonIterativeWithConfiguration(before, after, configuration, iterations, error);
 			case ComputationMethod::Cpd:
 				return CoherentPointDrift::CalculateCpdWithConfiguration(before, after, configuration, iterations, error);
+			case ComputationMethod::NonRigidCpd:
+				return CoherentPointDrift::CalculateNonRigidCpdWithConfiguration(before, after, configuration, iterations, error);
 			default:
 				assert(false); //unknown method
 				return BasicICP::CalculateICPWithConfiguration(before, after, configuration, iterations, error);
@@ -25,11 +28,42 @@ namespace {
 
 	int RunCpuTests()
 	{ 
-		srand(Tests::RANDOM_SEED);
-		Common::SetRandom();
+		Common::SetRandomSeed(Tests::RANDOM_SEED);
+
+		if (!Tests::CheckSigmaSquaredInitialisation("data"))
+			return 1;
+
+		if (!Tests::CheckIterationAllocations(LoadCloud("data/bunny.obj")))
+			return 1;
+
+		if (!Tests::CheckLowRankKernel(LoadCloud("data/bird.obj")) || !Tests::CheckNonRigidCpd(LoadCloud("data/bird.obj")))
+			return 1;
+
+		if (!Tests::CheckNonIterativeResultHeap())
+			return 1;
 
 		const auto methods = { ComputationMethod::Icp, ComputationMethod::NoniterativeIcp, ComputationMethod::Cpd };
 		Tests::RunTestSet(GetSizesTestSet, GetCpuSlamResult, "sizes", methods);
+
+		// Nearest neighbour search benchmark, brute force vs kd-tree
+		Tests::RunTestSet([](ComputationMethod method) { return GetNearestNeighbourTestSet(method, NearestNeighbourMethod::BruteForce); }, GetCpuSlamResult, "nn-brute-force", { ComputationMethod::Icp });
+		Tests::RunTestSet([](ComputationMethod method) { return GetNearestNeighbourTestSet(method, NearestNeighbourMethod::KdTree); }, GetCpuSlamResult, "nn-kd-tree", { ComputationMethod::Icp });
+
+		// Same with small max distance, brute force vs kd-tree vs voxel grid
+		Tests::RunTestSet([](ComputationMethod method) { return GetLocalNearestNeighbourTestSet(method, NearestNeighbourMethod::BruteForce); }, GetCpuSlamResult, "nn-local-brute-force", { ComputationMethod::Icp });
+		Tests::RunTestSet([](ComputationMethod method) { return GetLocalNearestNeighbourTestSet(method, NearestNeighbourMethod::KdTree); }, GetCpuSlamResult, "nn-local-kd-tree", { ComputationMethod::Icp });
+		Tests::RunTestSet([](ComputationMethod method) { return GetLocalNearestNeighbourTestSet(method, NearestNeighbourMethod::VoxelGrid); }, GetCpuSlamResult, "nn-local-voxel-grid", { ComputationMethod::Icp });
+
+		// FGT expansion benchmark, generic vs unrolled for every order of truncation
+		const auto bunny = LoadCloud("data/bunny.obj");
+		Tests::BenchmarkMonomialKernels(bunny, std::sqrt(2.0f * CoherentPointDrift::CalculateSigmaSquared(bunny, bunny)), 50, 10.0f);
+
+		// Truncated E-step with and without the sparse P matrix
+		Tests::BenchmarkSparsePMatrix(bunny, "bunny");
+		Tests::BenchmarkSparsePMatrix(LoadCloud("data/bird.obj"), "bird");
+
+		// NICP backend, SVD of 3 x N matrices vs 3x3 scatter matrices, larger clouds take too long for the default test run
+		Tests::BenchmarkSingleNonIterativeSlamResult({ 100000, 250000 });
 		return 0;
 	}
 }
@@ -0,0 +1,340 @@
+#include <chrono>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include "cputests.h"
+#include "allocationcounter.h"
+#include "basicicp.h"
+#include "coherentpointdrift.h"
+#include "configuration.h"
+#include "fgt.h"
+#include "fgtmonomials.h"
+#include "nicputils.h"
+#include "noniterative.h"
+#include "testutils.h"
+
+using namespace Common;
+
+namespace
+{
+	// Kernel values dropped by the truncated E-step in the sparse P matrix benchmark, the same as in ApproximationType::Hybrid
+	constexpr float BENCHMARK_TRUNCATION = 1e-3f;
+
+	// Checks of non-rigid CPD use every n-th point, so that the kernel matrix can be computed directly
+	constexpr int NON_RIGID_SUBCLOUD_STEP = 10;
+
+	// Every step-th point of the cloud moved to zero mean and unit variance, the units of the parameters of non-rigid CPD
+	std::vector<Point_f> GetNormalisedSubcloud(const std::vector<Point_f>& cloud, int step)
+	{
+		std::vector<Point_f> result;
+		for (size_t i = 0; i < cloud.size(); i += step)
+			result.push_back(cloud[i]);
+
+		Point_f mean = Point_f::Zero();
+		for (const auto& point : result)
+			mean += point;
+		mean = mean / static_cast<float>(result.size());
+
+		float squaredDistances = 0.0f;
+		for (const auto& point : result)
+			squaredDistances += (point - mean).LengthSquared();
+		const float scale = std::sqrt(squaredDistances / result.size());
+
+		for (auto& point : result)
+			point = (point - mean) / scale;
+		return result;
+	}
+
+	float GetRootMeanSquaredDistance(const std::vector<Point_f>& first, const std::vector<Point_f>& second)
+	{
+		float sum = 0.0f;
+		for (size_t i = 0; i < first.size(); i++)
+			sum += (first[i] - second[i]).LengthSquared();
+		return std::sqrt(sum / first.size());
+	}
+
+	// Previous backend of NICP, SVD of both centered clouds as 3 x N matrices, reference for the NICP benchmark
+	NonIterativeSlamResult GetSingleNonIterativeSlamResultWithSvd(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter)
+	{
+		glm::mat3 rotationMatrix = glm::mat3(1.0f);
+		glm::vec3 translationVector = glm::vec3(0.0f);
+		std::vector<Point_f> transformedCloud = cloudBefore;
+
+		Point_f centerBefore = GetCenterOfMass(cloudBefore);
+		Point_f centerAfter = GetCenterOfMass(cloudAfter);
+
+		std::vector<Point_f> alignedBefore = GetAlignedCloud(cloudBefore, centerBefore);
+		std::vector<Point_f> alignedAfter = GetAlignedCloud(cloudAfter, centerAfter);
+
+		Eigen::Matrix3Xf matrixBefore = GetMatrix3XFromPointsVector(alignedBefore);
+		Eigen::Matrix3Xf matrixAfter = GetMatrix3XFromPointsVector(alignedAfter);
+
+		//const Eigen::JacobiSVD<Eigen::Matrix3Xf> svdBefore = Eigen::JacobiSVD<Eigen::Matrix3Xf>(matrixBefore, Eigen::ComputeFullU | Eigen::ComputeFullV);
+		const Eigen::JacobiSVD<Eigen::Matrix3Xf> svdBefore = Eigen::JacobiSVD<Eigen::Matrix3Xf>(matrixBefore, Eigen::ComputeThinU | Eigen::ComputeThinV);
+		Eigen::Matrix3f uMatrixBeforeTransposed = svdBefore.matrixU().transpose();
+
+		//const Eigen::JacobiSVD<Eigen::Matrix3Xf> svdAfter = Eigen::JacobiSVD<Eigen::Matrix3Xf>(matrixAfter, Eigen::ComputeFullU | Eigen::ComputeFullV);
+		const Eigen::JacobiSVD<Eigen::Matrix3Xf> svdAfter = Eigen::JacobiSVD<Eigen::Matrix3Xf>(matrixAfter, Eigen::ComputeThinU | Eigen::ComputeThinV);
+		Eigen::Matrix3f uMatrixAfter = svdAfter.matrixU();
+
+		Eigen::Matrix3f rotation = uMatrixAfter * uMatrixBeforeTransposed;
+
+		rotationMatrix = ConvertRotationMatrix(rotation);
+		translationVector = glm::vec3(centerAfter) - (rotationMatrix * centerBefore);
+
+		float error = GetMeanSquaredError(alignedBefore, alignedAfter, rotationMatrix);
+		return NonIterativeSlamResult(rotationMatrix, translationVector, error);
+	}
+}
+
+namespace Tests
+{
+	// Checks
+	//
+	bool CheckIterationAllocations(const std::vector<Point_f>& cloud)
+	{
+		const auto after = GetTransformedCloud(cloud, GetRotationMatrix({ 0.0f, 1.0f, 0.0f }, 0.1f), glm::vec3(0.05f));
+
+		const auto count_allocations = [&](const auto& registration, int maxIterations) {
+			const auto allocationsBefore = GetAllocationCount();
+			registration(maxIterations);
+			return GetAllocationCount() - allocationsBefore;
+		};
+
+		// eps 0 keeps the registrations running for all iterations
+		const auto icp = [&](int maxIterations) {
+			int iterations = 0;
+			float error = 0.0f;
+			BasicICP::GetBasicICPTransformationMatrix(cloud, after, &iterations, &error, 0.0f, 1000.0f, maxIterations, true, NearestNeighbourMethod::KdTree);
+		};
+
+		const auto cpd = [&](int maxIterations) {
+			Configuration config;
+			config.ComputationMethod = ComputationMethod::Cpd;
+			config.MaxIterations = maxIterations;
+			config.ApproximationType = ApproximationType::None;
+			config.ConvergenceEpsilon = 0.0f;
+			config.CpdTolerance = 0.0f;
+			int iterations = 0;
+			float error = 0.0f;
+			CoherentPointDrift::CalculateCpdWithConfiguration(cloud, after, config, &iterations, &error);
+		};
+
+		bool correct = true;
+		const auto check = [&](const char* name, const auto& registration) {
+			const long long fewIterations = count_allocations(registration, 2);
+			const long long moreIterations = count_allocations(registration, 10);
+			printf("%s allocations: %lld in 2 iterations, %lld in 10 iterations\n", name, fewIterations, moreIterations);
+			if (fewIterations != moreIterations)
+				correct = false;
+		};
+
+		check("Icp", icp);
+		check("Cpd", cpd);
+		return correct;
+	}
+
+	bool CheckLowRankKernel(const std::vector<Point_f>& cloud, float tolerance)
+	{
+		const auto points = GetNormalisedSubcloud(cloud, NON_RIGID_SUBCLOUD_STEP);
+		const int M = static_cast<int>(points.size());
+		const Configuration config;
+
+		const auto kernel = CoherentPointDrift::ComputeLowRankKernel(points, config.CpdBeta, config.CpdKernelRank, 1e-4f, true);
+
+		Eigen::MatrixXf matrix(M, M);
+		const float multiplier = -0.5f / (config.CpdBeta * config.CpdBeta);
+		for (int i = 0; i < M; i++)
+			for (int j = 0; j < M; j++)
+				matrix(i, j) = std::exp(multiplier * (points[i] - points[j]).LengthSquared());
+
+		auto random = RandomStream(GetRandomSeed(), RandomPurpose::Default);
+		const Eigen::MatrixXf vectors = Eigen::MatrixXf::NullaryExpr(M, DIMENSION, [&]() { return random.NextFloat(-1.0f, 1.0f); });
+		const Eigen::MatrixXf expected = matrix * vectors;
+		const Eigen::MatrixXf actual = kernel.eigenvectors * (kernel.eigenvalues.asDiagonal() * (kernel.eigenvectors.transpose() * vectors));
+
+		const float relativeError = (actual - expected).norm() / expected.norm();
+		printf("Low-rank kernel: %d points, rank %d, relative error %g\n", M, static_cast<int>(kernel.eigenvalues.size()), relativeError);
+		return relativeError <= tolerance;
+	}
+
+	bool CheckNonRigidCpd(const std::vector<Point_f>& cloud)
+	{
+		const auto before = GetNormalisedSubcloud(cloud, NON_RIGID_SUBCLOUD_STEP);
+
+		// displacement smooth compared to the kernel width, so that the regularised fit can follow it
+		auto after = before;
+		for (auto& point : after)
+			point += Point_f(std::sin(point.y), std::sin(point.z), std::sin(point.x)) * 0.2f;
+		const float initialDistance = GetRootMeanSquaredDistance(before, after);
+
+		bool correct = true;
+		for (auto approximation : { ApproximationType::None, ApproximationType::Full })
+		{
+			Configuration config;
+			int iterations = 0;
+			float error = 0.0f;
+			const auto result = CoherentPointDrift::GetNonRigidCPDTransformation(
+				before, after, &iterations, &error, config.ConvergenceEpsilon, 0.1f, 100, 1e-5f,
+				config.CpdBeta, config.CpdLambda, config.CpdKernelRank, approximation, config.RatioOfFarField, config.OrderOfTruncation, 0.0f);
+
+			const float distance = GetRootMeanSquaredDistance(result, after);
+			printf("Non-rigid Cpd, %s: %d iterations, distance to the deformed cloud %g, initially %g\n",
+				approximation == ApproximationType::None ? "exact" : "fgt", iterations, distance, initialDistance);
+			if (distance * 10.0f > initialDistance)
+				correct = false;
+		}
+
+		return correct;
+	}
+
+	bool CheckNonIterativeResultHeap()
+	{
+		constexpr int transformations = 3;
+		constexpr int copies = 4;
+		NonIterativeResultHeap heap(5);
+
+		// copy c of transformation t has error t + 1 + (copies - c) / 10, so the last copy is the best one
+		for (int c = 0; c < copies; c++)
+		{
+			for (int t = 0; t < transformations; t++)
+			{
+				const auto rotation = GetRotationMatrix({ 0.0f, 0.0f, 1.0f }, 0.5f * t);
+				const glm::vec3 translation(static_cast<float>(t), 0.0f, 0.0f);
+				heap.Push(NonIterativeSlamResult(rotation, translation, t + 1.0f + (copies - c) / 10.0f), c * transformations + t);
+			}
+		}
+
+		const auto kept = heap.GetSorted();
+		bool correct = kept.size() == transformations;
+		for (int t = 0; correct && t < transformations; t++)
+			correct = kept[t].repetition == (copies - 1) * transformations + t;
+
+		printf("Nicp result heap: %zu results kept of %d distinct transformations\n", kept.size(), transformations);
+		return correct;
+	}
+
+	// Benchmarks
+	//
+	void BenchmarkMonomialKernels(
+		const std::vector<Point_f>& cloud,
+		const float& sigma,
+		const int& K_param,
+		const float& e_param)
+	{
+		FastGaussTransform::FGT_Clustering clustering;
+		FastGaussTransform::UpdateFGTClustering(cloud, K_param, &clustering);
+
+		// weights of the CPD E-step shape: ones and every coordinate
+		std::vector<std::vector<float>> weights = { std::vector<float>(cloud.size(), 1.0f) };
+		for (int i = 0; i < DIMENSION; i++)
+		{
+			weights.push_back(std::vector<float>(cloud.size()));
+			std::transform(cloud.begin(), cloud.end(), weights.back().begin(), [i](const Point_f& point) { return point[i]; });
+		}
+
+		const auto run = [&](const auto& monomials, Eigen::MatrixXf* result) {
+			const auto begin = std::chrono::steady_clock::now();
+
+			FastGaussTransform::FGT_Model model = { clustering.xc, Eigen::MatrixXf::Zero(monomials.GetCount() * weights.size(), clustering.K) };
+			FastGaussTransform::ComputeA_k(monomials, cloud, weights, clustering.xc, clustering.indx, sigma, clustering.K, &model.Ak);
+			*result = Eigen::MatrixXf::Zero(cloud.size(), weights.size());
+			FastGaussTransform::ComputeFGTMultiPredict(monomials, cloud, model, sigma, e_param, result);
+
+			const auto duration = std::chrono::steady_clock::now() - begin;
+			return static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+		};
+
+		printf("FGT monomial kernels, %zu points, K = %d\n", cloud.size(), K_param);
+		for (int p = FastGaussTransform::MIN_FIXED_ORDER; p <= FastGaussTransform::MAX_FIXED_ORDER; p++)
+		{
+			Eigen::MatrixXf generic, fixed;
+			const long long genericTime = run(FastGaussTransform::GenericMonomials(p), &generic);
+			long long fixedTime = 0;
+			FastGaussTransform::DispatchOrder(p, [&](const auto& monomials) { fixedTime = run(monomials, &fixed); });
+
+			const float difference = (generic - fixed).cwiseAbs().maxCoeff() / generic.cwiseAbs().maxCoeff();
+			printf("p = %d: generic %lld us, fixed order %lld us, relative difference %g\n", p, genericTime, fixedTime, difference);
+		}
+	}
+
+	void BenchmarkSparsePMatrix(const std::vector<Point_f>& cloud, const char* name)
+	{
+		const int N = static_cast<int>(cloud.size());
+		const float weight = 0.3f;
+		const float sigmaSquaredInit = CoherentPointDrift::CalculateSigmaSquared(cloud, cloud);
+
+		const auto megabytes = [](size_t bytes) { return bytes / (1024.0 * 1024.0); };
+		printf("Sparse P matrix, %s, %d points, dense matrix %.1f MB\n", name, N, megabytes(sizeof(float) * N * static_cast<size_t>(N)));
+
+		CoherentPointDrift::Workspace workspace;
+		for (float ratio : { 1e-2f, 1e-3f, 1e-4f })
+		{
+			const float sigmaSquared = ratio * sigmaSquaredInit;
+			const float constant = (std::pow(2 * M_PI * sigmaSquared, (float)DIMENSION * 0.5f) * weight * N) / ((1 - weight) * N);
+
+			// second run is measured, so that buffers are already allocated
+			const auto run = [&](bool sparse) {
+				workspace.useSparsePMatrix = sparse;
+				workspace.sparsePMatrix.rowOffsets.clear();
+				CoherentPointDrift::ComputePMatrix(cloud, cloud, constant, sigmaSquared, true, &workspace, true, BENCHMARK_TRUNCATION);
+
+				const auto begin = std::chrono::steady_clock::now();
+				CoherentPointDrift::ComputePMatrix(cloud, cloud, constant, sigmaSquared, true, &workspace, true, BENCHMARK_TRUNCATION);
+				const auto duration = std::chrono::steady_clock::now() - begin;
+				return static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+			};
+
+			const long long directTime = run(false);
+			const Eigen::MatrixXf directPx = workspace.probabilities.px;
+			const long long sparseTime = run(true);
+
+			const auto& sparse = workspace.sparsePMatrix;
+			if (sparse.rowOffsets.empty())
+			{
+				printf("sigma squared x %g: too many candidates, all pairs computed, %lld us\n", ratio, directTime);
+				continue;
+			}
+
+			const float difference = (directPx - workspace.probabilities.px).cwiseAbs().maxCoeff() / directPx.cwiseAbs().maxCoeff();
+			printf("sigma squared x %g: %zu non-zero (%.3f%%), %.2f MB, direct %lld us, sparse %lld us, relative difference %g\n",
+				ratio, sparse.GetNonZeroCount(), 100.0 * sparse.GetNonZeroCount() / (static_cast<double>(N) * N), megabytes(sparse.GetMemorySize()),
+				directTime, sparseTime, difference);
+		}
+	}
+
+	void BenchmarkSingleNonIterativeSlamResult(const std::vector<int>& sizes)
+	{
+		const auto rotation = GetRotationMatrix({ 1.0f, 2.0f, 3.0f }, 0.5f);
+		const glm::vec3 translation = { 1.0f, -2.0f, 0.5f };
+
+		for (const int size : sizes)
+		{
+			// extents differ, so that principal axes are well defined
+			const auto cloudBefore = GetRandomPointCloud({ -1.0f, -2.0f, -3.0f }, { 2.0f, 4.0f, 6.0f }, size);
+			const auto cloudAfter = GetTransformedCloud(cloudBefore, rotation, translation);
+
+			const auto time = [](const auto& func) {
+				const auto start = std::chrono::high_resolution_clock::now();
+				const NonIterativeSlamResult result = func();
+				const std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+				return std::make_pair(result, elapsed.count());
+			};
+
+			const auto [svdResult, svdTime] = time([&]() { return GetSingleNonIterativeSlamResultWithSvd(cloudBefore, cloudAfter); });
+			const auto [sequentialResult, sequentialTime] = time([&]() { return NonIterative::GetSingleNonIterativeSlamResult(cloudBefore, cloudAfter, false); });
+			const auto [parallelResult, parallelTime] = time([&]() { return NonIterative::GetSingleNonIterativeSlamResult(cloudBefore, cloudAfter, true); });
+
+			// axes are known up to sign, so rotations are compared by their error against the true one
+			const auto rotation_error = [&rotation](const NonIterativeSlamResult& result) {
+				float maxDifference = 0.0f;
+				for (int i = 0; i < 3; i++)
+					for (int j = 0; j < 3; j++)
+						maxDifference = std::max(maxDifference, std::abs(result.getRotationMatrix()[i][j] - rotation[i][j]));
+				return maxDifference;
+			};
+
+			printf("Nicp single result, %d points: svd %.2f ms, scatter sequential %.2f ms, scatter parallel %.2f ms, rotation error svd %g, scatter %g\n",
+				size, svdTime, sequentialTime, parallelTime, rotation_error(svdResult), rotation_error(parallelResult));
+		}
+	}
+}
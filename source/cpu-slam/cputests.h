@@ -0,0 +1,44 @@
+#pragma once
+
+#include "common.h"
+
+namespace Tests
+{
+	// Checks
+	//
+	/// Runs ICP and exact rigid CPD of the cloud with its rotated copy for 2 and for 10 iterations. Iterations after the first one reuse their buffers,
+	/// so both runs should allocate the same number of times. Allocations are counted only in TEST builds
+	/// \returns true if additional iterations did not allocate
+	bool CheckIterationAllocations(const std::vector<Common::Point_f>& cloud);
+
+	/// Compares products of the low-rank displacement kernel of non-rigid CPD with products of the kernel matrix computed directly,
+	/// for every 10th point of the cloud normalised to unit variance and random vectors
+	/// \returns true if relative error of the products does not exceed tolerance
+	bool CheckLowRankKernel(const std::vector<Common::Point_f>& cloud, float tolerance = 1e-2f);
+
+	/// Registers every 10th point of the cloud with its copy bent by a smooth displacement field, with exact and full FGT E-steps
+	/// \returns true if non-rigid CPD moved the points at least 10 times closer to their deformed copies
+	bool CheckNonRigidCpd(const std::vector<Common::Point_f>& cloud);
+
+	/// Pushes every one of a few transformations to NonIterativeResultHeap from several repetitions with different errors
+	/// \returns true if the heap keeps only distinct transformations, each with its smallest error
+	bool CheckNonIterativeResultHeap();
+
+	// Benchmarks
+	//
+	/// Times model and prediction on the cloud with expansions unrolled for every fixed order against the generic expansion,
+	/// prints both times and the largest relative difference of results
+	void BenchmarkMonomialKernels(
+		const std::vector<Common::Point_f>& cloud,
+		const float& sigma,
+		const int& K_param,
+		const float& e_param);
+
+	/// Prints density, memory and E-step time of the sparse P matrix against the direct truncated E-step
+	/// for sigma squared decreasing from the initial one, cloud registered with itself
+	void BenchmarkSparsePMatrix(const std::vector<Common::Point_f>& cloud, const char* name);
+
+	/// Prints time of a single NICP result with SVD of 3 x N matrices against scatter matrices, sequential and parallel,
+	/// for random clouds of the given sizes and a known rotation
+	void BenchmarkSingleNonIterativeSlamResult(const std::vector<int>& sizes);
+}
@@ -1,102 +1,205 @@
+#include <array>
 #include <Eigen/Dense>
 
 #include "noniterative.h"
 #include "timer.h"
 #include "configuration.h"
 #include "nicputils.h"
-
-#include <thread>
+#include "kdtree.h"
+#include "threadpool.h"
 
 using namespace Common;
 
-namespace NonIterative
+namespace
 {
-	std::pair<glm::mat3, glm::vec3> CalculateNonIterativeWithConfiguration(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, Common::Configuration config, int* repetitions, float* error)
+	// Proper rotations between two sets of principal axes known up to sign
+	constexpr int SIGN_COMBINATIONS = 4;
+
+	// Rotations axesAfter * diag(signs) * axesBefore^T. Of 8 sign combinations the 4 with product of signs
+	// equal to the product of determinants of both axes give proper rotations
+	std::array<Eigen::Matrix3f, SIGN_COMBINATIONS> GetProperRotations(const Eigen::Matrix3f& axesBefore, const Eigen::Matrix3f& axesAfter)
 	{
-		auto maxIterations = config.NicpIterations;
+		const float determinantSign = axesAfter.determinant() * axesBefore.determinant() > 0.0f ? 1.0f : -1.0f;
+		std::array<Eigen::Matrix3f, SIGN_COMBINATIONS> rotations;
+		for (int i = 0; i < SIGN_COMBINATIONS; i++)
+		{
+			Eigen::Vector3f signs((i & 1) ? -1.0f : 1.0f, (i & 2) ? -1.0f : 1.0f, 1.0f);
+			signs.z() = signs.x() * signs.y() * determinantSign;
+			rotations[i] = axesAfter * signs.asDiagonal() * axesBefore.transpose();
+		}
+		return rotations;
+	}
 
-		auto parallel = config.ExecutionPolicy.has_value() ?
-			config.ExecutionPolicy.value() == Common::ExecutionPolicy::Parallel :
-			true;
+	// Rotation between principal axes of both clouds for every sign combination, ordered by approximated error.
+	// Mean of |a - R * b|^2 over pairs of centered points is (sum |a|^2 + sum |b|^2 - 2 * trace(R^T * C)) / count
+	std::array<NonIterativeSlamResult, SIGN_COMBINATIONS> GetRankedNonIterativeSlamResults(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, bool parallel)
+	{
+		// Only left singular vectors of the centered clouds are used, they are eigenvectors of the 3x3 scatter matrices,
+		// which are gathered in one pass without copies of the clouds
+		const PairedCloudScatter scatter = GetPairedCloudScatter(cloudBefore, cloudAfter, parallel);
+		const auto rotations = GetProperRotations(GetPrincipalAxes(scatter.before.scatter), GetPrincipalAxes(scatter.after.scatter));
+
+		std::array<double, SIGN_COMBINATIONS> crossTerms;
+		std::array<int, SIGN_COMBINATIONS> order;
+		for (int i = 0; i < SIGN_COMBINATIONS; i++)
+		{
+			crossTerms[i] = scatter.crossCovariance.cwiseProduct(rotations[i].cast<double>()).sum();
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [&crossTerms](int first, int second) { return crossTerms[first] > crossTerms[second]; });
 
-		return GetNonIterativeTransformationMatrix(cloudBefore, cloudAfter, repetitions, error, config.ConvergenceEpsilon, maxIterations, config.ApproximationType, parallel, config.NicpSubcloudSize);
+		const glm::vec3 centerBefore(scatter.before.center.x(), scatter.before.center.y(), scatter.before.center.z());
+		const glm::vec3 centerAfter(scatter.after.center.x(), scatter.after.center.y(), scatter.after.center.z());
+
+		std::array<NonIterativeSlamResult, SIGN_COMBINATIONS> results;
+		for (int rank = 0; rank < SIGN_COMBINATIONS; rank++)
+		{
+			const int chosen = order[rank];
+			const glm::mat3 rotationMatrix = ConvertRotationMatrix(rotations[chosen]);
+			const glm::vec3 translationVector = centerAfter - rotationMatrix * centerBefore;
+
+			const double squaredErrors = scatter.pairVarianceBefore + scatter.pairVarianceAfter - 2.0 * crossTerms[chosen];
+			const float error = static_cast<float>(std::max(squaredErrors, 0.0) / std::max(scatter.count, 1));
+			results[rank] = NonIterativeSlamResult(rotationMatrix, translationVector, error);
+		}
+		return results;
 	}
 
-	NonIterativeSlamResult GetSingleNonIterativeSlamResult(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter)
+	// Candidates are scored on nested prefixes of the comparison subcloud, every stage is this many times longer than the previous one
+	constexpr int FIRST_SCORING_STAGE = 64;
+	constexpr int SCORING_STAGE_GROWTH = 4;
+
+	// Mean squared distance of the transformed subcloud to its closest points in cloudAfter, equal to GetCorrespondingPoints followed by GetMeanSquaredError.
+	// Subcloud is in random order, so its prefixes are nested random samples. Distances are never negative, so after every stage
+	// sum / subcloud size is a lower bound of the final error, and the candidate is abandoned once it cannot be better than errorBound
+	// \returns Error, or its lower bound not smaller than errorBound for abandoned candidates
+	float GetSubcloudError(const std::vector<Point_f>& subcloud, const std::vector<Point_f>& cloudAfter, const KdTree& cloudAfterIndex, const std::pair<glm::mat3, glm::vec3>& transformation,
+		float maxDistanceSquared, bool parallel, float errorBound = std::numeric_limits<float>::max())
 	{
-		glm::mat3 rotationMatrix = glm::mat3(1.0f);
-		glm::vec3 translationVector = glm::vec3(0.0f);
-		std::vector<Point_f> transformedCloud = cloudBefore;
+		const int size = static_cast<int>(subcloud.size());
+		std::vector<float> distances(size);
+		const auto calculate_distances = [&](int beginIndex, int endIndex) {
+			for (int i = beginIndex; i < endIndex; i++)
+			{
+				const Point_f transformed = TransformPoint(subcloud[i], transformation.first, transformation.second);
+				const int closestIndex = cloudAfterIndex.FindNearest(transformed, maxDistanceSquared);
+				distances[i] = closestIndex < 0 ? maxDistanceSquared : (cloudAfter[closestIndex] - transformed).LengthSquared();
+			}
+		};
 
-		Point_f centerBefore = GetCenterOfMass(cloudBefore);
-		Point_f centerAfter = GetCenterOfMass(cloudAfter);
+		// Distances are summed in order, so the error is the same for parallel and sequential execution
+		float diffSum = 0.0f;
+		int pairs = 0;
+		for (int stageBegin = 0, stageEnd = std::min(FIRST_SCORING_STAGE, size); stageBegin < size; stageBegin = stageEnd, stageEnd = std::min(stageEnd * SCORING_STAGE_GROWTH, size))
+		{
+			if (parallel)
+				ThreadPool::GetInstance().ParallelFor(stageBegin, stageEnd, calculate_distances);
+			else
+				calculate_distances(stageBegin, stageEnd);
 
-		std::vector<Point_f> alignedBefore = GetAlignedCloud(cloudBefore, centerBefore);
-		std::vector<Point_f> alignedAfter = GetAlignedCloud(cloudAfter, centerAfter);
+			for (int i = stageBegin; i < stageEnd; i++)
+			{
+				if (distances[i] < maxDistanceSquared)
+				{
+					diffSum += distances[i];
+					pairs++;
+				}
+			}
 
-		Eigen::Matrix3Xf matrixBefore = GetMatrix3XFromPointsVector(alignedBefore);
-		Eigen::Matrix3Xf matrixAfter = GetMatrix3XFromPointsVector(alignedAfter);
+			const float lowerBound = diffSum / size;
+			if (stageEnd < size && lowerBound >= errorBound)
+				return lowerBound;
+		}
 
-		//const Eigen::JacobiSVD<Eigen::Matrix3Xf> svdBefore = Eigen::JacobiSVD<Eigen::Matrix3Xf>(matrixBefore, Eigen::ComputeFullU | Eigen::ComputeFullV);
-		const Eigen::JacobiSVD<Eigen::Matrix3Xf> svdBefore = Eigen::JacobiSVD<Eigen::Matrix3Xf>(matrixBefore, Eigen::ComputeThinU | Eigen::ComputeThinV);
-		Eigen::Matrix3f uMatrixBeforeTransposed = svdBefore.matrixU().transpose();
+		return diffSum / pairs;
+	}
+}
 
-		//const Eigen::JacobiSVD<Eigen::Matrix3Xf> svdAfter = Eigen::JacobiSVD<Eigen::Matrix3Xf>(matrixAfter, Eigen::ComputeFullU | Eigen::ComputeFullV);
-		const Eigen::JacobiSVD<Eigen::Matrix3Xf> svdAfter = Eigen::JacobiSVD<Eigen::Matrix3Xf>(matrixAfter, Eigen::ComputeThinU | Eigen::ComputeThinV);
-		Eigen::Matrix3f uMatrixAfter = svdAfter.matrixU();
+namespace NonIterative
+{
+	std::pair<glm::mat3, glm::vec3> CalculateNonIterativeWithConfiguration(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, Common::Configuration config, int* repetitions, float* error)
+	{
+		auto maxIterations = config.NicpIterations;
 
-		Eigen::Matrix3f rotation = uMatrixAfter * uMatrixBeforeTransposed;
+		auto parallel = config.ExecutionPolicy.has_value() ?
+			config.ExecutionPolicy.value() == Common::ExecutionPolicy::Parallel :
+			true;
 
-		rotationMatrix = ConvertRotationMatrix(rotation);
-		translationVector = glm::vec3(centerAfter) - (rotationMatrix * centerBefore);
+		// automatic approximation only concerns CPD, errors are computed exactly
+		auto approximationType = config.ApproximationType == ApproximationType::Auto ? ApproximationType::None : config.ApproximationType;
 
-		float error = GetMeanSquaredError(alignedBefore, alignedAfter, rotationMatrix);
-		return NonIterativeSlamResult(rotationMatrix, translationVector, error);
+		return GetNonIterativeTransformationMatrix(cloudBefore, cloudAfter, repetitions, error, config.ConvergenceEpsilon, maxIterations, approximationType, parallel, config.NicpSubcloudSize);
+	}
+
+	NonIterativeSlamResult GetSingleNonIterativeSlamResult(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, bool parallel, int signRank)
+	{
+		return GetRankedNonIterativeSlamResults(cloudBefore, cloudAfter, parallel)[signRank % SIGN_COMBINATIONS];
 	}
 
 	std::pair<glm::mat3, glm::vec3> GetNonIterativeTransformationMatrixParallel(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, int *repetitions, float* error, float eps, int maxRepetitions, int batchSize, const ApproximationType& calculationType, int subcloudSize)
 	{
-		int cloudSize = std::min(cloudBefore.size(), cloudAfter.size());
 		if (maxRepetitions == -1)
 			maxRepetitions = 20;
 
-		// Split number of repetitions to batches
-		auto batchesCount = maxRepetitions / batchSize;
-		auto lastBatchSize = maxRepetitions % batchSize;
-		auto threadsToRun = batchSize;
+		// Scatter matrices do not depend on order of points, so repetitions differ only by sign rank of the principal axes
+		maxRepetitions = std::min(maxRepetitions, SIGN_COMBINATIONS);
+		const auto results = GetRankedNonIterativeSlamResults(cloudBefore, cloudAfter, true);
 
 		std::pair<glm::mat3, glm::vec3> bestTransformation;
 		float minError = std::numeric_limits<float>::max();
 
 		// Get subcloud for comparison
-		std::vector<Point_f>subcloudVertices = GetSubcloud(cloudBefore, subcloudSize);
+		RandomStream subcloudRandom(GetRandomSeed(), RandomPurpose::NicpSubcloud);
+		std::vector<Point_f>subcloudVertices = GetSubcloud(cloudBefore, subcloudSize, subcloudRandom);
 		const float maxDistanceForComparison = 1e6;
 
-		// Run NonIterative SLAM for multiple permutations and return the best fit
-		std::vector<NonIterativeSlamResult> bestResults;
+		// One index of cloudAfter serves all error evaluations
+		const KdTree cloudAfterIndex(cloudAfter);
 
-		std::vector<std::thread> threads(batchSize);
-		std::vector<NonIterativeSlamResult> transformationResults(batchSize);
-		std::vector<float> errors(batchSize);
+		*repetitions = maxRepetitions;
 
-		const auto slam_thread_work = [&](int index) {
-			const auto permutation = GetRandomPermutationVector(cloudSize);
-			const auto permutedBefore = ApplyPermutation(cloudBefore, permutation);
-			const auto permutedAfter = ApplyPermutation(cloudAfter, permutation);
+		// Results are ranked by approximated error, full approximation takes the best one and hybrid approximation compares exact errors of all of them.
+		// The best ranked result is scored first, and other results are scored in parallel and abandoned once they cannot beat its error
+		if (calculationType != ApproximationType::None)
+		{
+			const int scoredResults = calculationType == ApproximationType::Hybrid ? maxRepetitions : 1;
+			minError = GetSubcloudError(subcloudVertices, cloudAfter, cloudAfterIndex, results[0].getTransformation(), maxDistanceForComparison, true);
+			bestTransformation = results[0].getTransformation();
+			if (minError <= eps)
+			{
+				*repetitions = 1;
+				*error = minError;
+				return bestTransformation;
+			}
 
-			const auto transformationResult = GetSingleNonIterativeSlamResult(permutedBefore, permutedAfter);
-			errors[index] = transformationResults[index].getApproximatedError();
+			// Bound is fixed while the loop runs, so which results are abandoned does not depend on scheduling
+			std::vector<float> errors(scoredResults);
+			ThreadPool::GetInstance().ParallelFor(1, scoredResults, [&](int beginIndex, int endIndex) {
+				for (int i = beginIndex; i < endIndex; i++)
+					errors[i] = GetSubcloudError(subcloudVertices, cloudAfter, cloudAfterIndex, results[i].getTransformation(), maxDistanceForComparison, false, minError);
+			}, 1);
 
-			// If not using approximation, calculate error for selected subcloud
-			if (calculationType == ApproximationType::None)
+			for (int i = 1; i < scoredResults; i++)
 			{
-				std::vector<Point_f> transformedSubcloud = GetTransformedCloud(subcloudVertices, transformationResult.getRotationMatrix(), transformationResult.getTranslationVector());
-				CorrespondingPointsTuple correspondingPoints = GetCorrespondingPoints(transformedSubcloud, permutedAfter, maxDistanceForComparison, true);
-				errors[index] = GetMeanSquaredError(std::get<0>(correspondingPoints), std::get<1>(correspondingPoints));
+				if (errors[i] < minError)
+				{
+					minError = errors[i];
+					bestTransformation = results[i].getTransformation();
+				}
 			}
 
-			transformationResults[index] = transformationResult;
-		};
+			*error = minError;
+			return bestTransformation;
+		}
+
+		// If not using approximation, calculate error for selected subcloud. Repetitions are split to batches,
+		// so that the first result below eps is returned, and the best error of previous batches abandons worse candidates early
+		auto batchesCount = maxRepetitions / batchSize;
+		auto lastBatchSize = maxRepetitions % batchSize;
+		auto threadsToRun = batchSize;
+
+		std::vector<NonIterativeSlamResult> transformationResults(batchSize);
+		std::vector<float> errors(batchSize);
 
 		for (int i = 0; i <= batchesCount; i++)
 		{
@@ -108,87 +211,27 @@ namespace NonIterative
 					break;
 			}
 
-			for (int j = 0; j < threadsToRun; j++)
-			{
-				threads[j] = std::thread(slam_thread_work, j);
-			}
-
-			for (int j = 0; j < threadsToRun; j++)
-				threads[j].join();
-
-			for (int j = 0; j < threadsToRun; j++)
-			{
-				*error = errors[j];
-
-				// If not using approximation, calculate error for selected subcloud
-				if (calculationType == ApproximationType::None)
-				{
-					if (*error < minError)
-					{
-						minError = *error;
-						bestTransformation = transformationResults[j].getTransformation();
-
-						if (minError <= eps)
-						{
-							*repetitions = i * batchSize + j + 1;
-							return bestTransformation;
-						}
-					}
-				}
-				// If using hybrid approximation, select 5 best fits for further analysis
-				else if (calculationType == ApproximationType::Hybrid)
-				{
-					StoreResultIfOptimal(bestResults, transformationResults[j], 5);
-				}
-				// If using full approximation, select the best result for further error calculation
-				else if (calculationType == ApproximationType::Full)
+			// minError changes only between batches, so which candidates are abandoned does not depend on scheduling
+			ThreadPool::GetInstance().ParallelFor(0, threadsToRun, [&](int beginIndex, int endIndex) {
+				for (int j = beginIndex; j < endIndex; j++)
 				{
-					StoreResultIfOptimal(bestResults, transformationResults[j], 1);
+					transformationResults[j] = results[i * batchSize + j];
+					errors[j] = GetSubcloudError(subcloudVertices, cloudAfter, cloudAfterIndex, transformationResults[j].getTransformation(), maxDistanceForComparison, false, minError);
 				}
-			}
-		}
-
-		std::vector<float> exactErrors(bestResults.size());
-		const auto get_exact_error = [&](int index) {
-			std::vector<Point_f> transformedSubcloud = GetTransformedCloud(subcloudVertices, bestResults[index].getRotationMatrix(), bestResults[index].getTranslationVector());
-			CorrespondingPointsTuple correspondingPoints = GetCorrespondingPoints(transformedSubcloud, cloudAfter, maxDistanceForComparison, true);
-			exactErrors[index] = GetMeanSquaredError(std::get<0>(correspondingPoints), std::get<1>(correspondingPoints));
-		};
-
-		*repetitions = maxRepetitions;
-
-		// If using hybrid approximation, select best result
-		if (calculationType == ApproximationType::Full)
-		{
-			get_exact_error(0);
+			}, 1);
 
-			*error = exactErrors[0];
-			return bestResults[0].getTransformation();
-		}
-		else if (calculationType == ApproximationType::Hybrid)
-		{
-			minError = std::numeric_limits<float>::max();
-			std::vector<std::thread> errorThreads(bestResults.size());
-
-			for (int i = 0; i < bestResults.size(); i++)
-			{
-				errorThreads[i] = std::thread(get_exact_error, i);
-			}
-			
-			for (int i = 0; i < bestResults.size(); i++)
-				errorThreads[i].join();
-
-			for (int i = 0; i < bestResults.size(); i++)
+			for (int j = 0; j < threadsToRun; j++)
 			{
-				*error = exactErrors[i];
+				*error = errors[j];
 
 				if (*error < minError)
 				{
 					minError = *error;
-					bestTransformation = bestResults[i].getTransformation();
+					bestTransformation = transformationResults[j].getTransformation();
 
 					if (minError <= eps)
 					{
+						*repetitions = i * batchSize + j + 1;
 						return bestTransformation;
 					}
 				}
@@ -201,80 +244,41 @@ namespace NonIterative
 
 	std::pair<glm::mat3, glm::vec3> GetNonIterativeTransformationMatrixSequential(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, int* repetitions, float* error, float eps, int maxRepetitions, const ApproximationType& calculationType, int subcloudSize)
 	{
-		int cloudSize = std::min(cloudBefore.size(), cloudAfter.size());
 		if (maxRepetitions == -1)
 			maxRepetitions = 20;
 
+		// Scatter matrices do not depend on order of points, so repetitions differ only by sign rank of the principal axes
+		maxRepetitions = std::min(maxRepetitions, SIGN_COMBINATIONS);
+		const auto results = GetRankedNonIterativeSlamResults(cloudBefore, cloudAfter, false);
+
 		std::pair<glm::mat3, glm::vec3> bestTransformation;
 		float minError = std::numeric_limits<float>::max();
 
 		// Get subcloud for comparison
-		std::vector<Point_f>subcloudVertices = GetSubcloud(cloudBefore, subcloudSize);
+		RandomStream subcloudRandom(GetRandomSeed(), RandomPurpose::NicpSubcloud);
+		std::vector<Point_f>subcloudVertices = GetSubcloud(cloudBefore, subcloudSize, subcloudRandom);
 		const float maxDistanceForComparison = 1e6;
 
-		// Run NonIterative SLAM for multiple permutations and return the best fit
-		std::vector<NonIterativeSlamResult> bestResults;
-		for (int i = 0; i < maxRepetitions; i++)
-		{
-			const auto permutation = GetRandomPermutationVector(cloudSize);
-			const auto permutedBefore = ApplyPermutation(cloudBefore, permutation);
-			const auto permutedAfter = ApplyPermutation(cloudAfter, permutation);
-
-			NonIterativeSlamResult transformationResult = GetSingleNonIterativeSlamResult(permutedBefore, permutedAfter);
-			*error = transformationResult.getApproximatedError();
-			// If not using approximation, calculate error for selected subcloud
-			if (calculationType == ApproximationType::None)
-			{
-				std::vector<Point_f> transformedSubcloud = GetTransformedCloud(subcloudVertices, transformationResult.getRotationMatrix(), transformationResult.getTranslationVector());
-				CorrespondingPointsTuple correspondingPoints = GetCorrespondingPoints(transformedSubcloud, permutedAfter, maxDistanceForComparison, true);
-				*error = GetMeanSquaredError(std::get<0>(correspondingPoints), std::get<1>(correspondingPoints));
-
-				if (*error < minError)
-				{
-					minError = *error;
-					bestTransformation = transformationResult.getTransformation();
-
-					if (minError <= eps)
-					{
-						*repetitions = i + 1;
-						return bestTransformation;
-					}
-				}
-			}
-			// If using hybrid approximation, select 5 best fits for further analysis
-			else if (calculationType == ApproximationType::Hybrid)
-			{
-				StoreResultIfOptimal(bestResults, transformationResult, 5);
-			}
-			// If using full approximation, select the best result for further error calculation
-			else if(calculationType == ApproximationType::Full)
-			{
-				StoreResultIfOptimal(bestResults, transformationResult, 1);
-			}
-		}
+		// One index of cloudAfter serves all error evaluations
+		const KdTree cloudAfterIndex(cloudAfter);
 
+		// Results are ranked by approximated error, full approximation takes the best one, otherwise exact errors of all of them are compared.
+		// They are scored in rank order, so the best error so far abandons worse results early
+		const int scoredResults = calculationType == ApproximationType::Full ? 1 : maxRepetitions;
 		*repetitions = maxRepetitions;
-
-		// If using hybrid approximation, select best result
-		// If using full approximation, calculate exact error for the best result
-		if (calculationType != ApproximationType::None)
+		for (int i = 0; i < scoredResults; i++)
 		{
-			minError = std::numeric_limits<float>::max();
-			for (int i = 0; i < bestResults.size(); i++)
+			*error = GetSubcloudError(subcloudVertices, cloudAfter, cloudAfterIndex, results[i].getTransformation(), maxDistanceForComparison, true, minError);
+
+			if (*error < minError)
 			{
-				std::vector<Point_f> transformedSubcloud = GetTransformedCloud(subcloudVertices, bestResults[i].getRotationMatrix(), bestResults[i].getTranslationVector());
-				CorrespondingPointsTuple correspondingPoints = GetCorrespondingPoints(transformedSubcloud, cloudAfter, maxDistanceForComparison, true);
-				*error = GetMeanSquaredError(std::get<0>(correspondingPoints), std::get<1>(correspondingPoints));
+				minError = *error;
+				bestTransformation = results[i].getTransformation();
 
-				if (*error < minError)
+				if (minError <= eps)
 				{
-					minError = *error;
-					bestTransformation = bestResults[i].getTransformation();
-
-					if (minError <= eps)
-					{
-						return bestTransformation;
-					}
+					*repetitions = i + 1;
+					return bestTransformation;
 				}
 			}
 		}
@@ -286,7 +290,7 @@ namespace NonIterative
 	std::pair<glm::mat3, glm::vec3> GetNonIterativeTransformationMatrix(const std::vector<Point_f>& cloudBefore, const std::vector<Point_f>& cloudAfter, int *repetitions, float* error, float eps, int maxRepetitions, const ApproximationType& calculationType, bool parallel, int subcloudSize)
 	{
 		if (parallel)
-			return GetNonIterativeTransformationMatrixParallel(cloudBefore, cloudAfter, repetitions, error, eps, maxRepetitions, (int)std::thread::hardware_concurrency(), calculationType, subcloudSize);
+			return GetNonIterativeTransformationMatrixParallel(cloudBefore, cloudAfter, repetitions, error, eps, maxRepetitions, ThreadPool::GetInstance().GetThreadCount(), calculationType, subcloudSize);
 		else
 			return GetNonIterativeTransformationMatrixSequential(cloudBefore, cloudAfter, repetitions, error, eps, maxRepetitions, calculationType, subcloudSize);
 	}
@@ -20,10 +20,15 @@ namespace NonIterative
 		int* repetitions,
 		float* error);
 
+	/// Rotation between principal axes of both clouds, approximated error is mean squared distance of centered points with equal indices
+	/// \param signRank Axes are known up to sign, proper rotations between them are ordered by approximated error and this one is taken
 	NonIterativeSlamResult GetSingleNonIterativeSlamResult(
 		const std::vector<Point_f>& cloudBefore,
-		const std::vector<Point_f>& cloudAfter);
+		const std::vector<Point_f>& cloudAfter,
+		bool parallel = false,
+		int signRank = 0);
 
+	/// \param maxRepetitions Capped at 4, the principal axes of both clouds are found once and repetitions take their sign combinations in order of approximated error
 	std::pair<glm::mat3, glm::vec3> GetNonIterativeTransformationMatrix(
 		const std::vector<Point_f>& cloudBefore, 
 		const std::vector<Point_f>& cloudAfter, 
@@ -34,4 +39,5 @@ namespace NonIterative
 		const ApproximationType& calculationType, 
 		bool parallel = false,
 		int subcloudSize = -1);
+
 }
\ No newline at end of file
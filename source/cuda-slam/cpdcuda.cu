@@ -38,7 +38,9 @@ namespace
 		const glm::vec3& translationVector,
 		const float& scale,
 		const float& ratioOfFarField,
-		const float& orderOfTruncation);
+		const float& orderOfTruncation,
+		const float& fgtErrorTolerance,
+		CoherentPointDrift::FGTCache* fgtCache);
 	void ComputePMatrixWithFGTOnCPU(
 		const std::vector<Point_f>& cloudBeforeCPU,
 		const std::vector<Point_f>& cloudAfterCPU,
@@ -50,7 +52,9 @@ namespace
 		const glm::vec3& translationVector,
 		const float& scale,
 		const float& ratioOfFarField,
-		const float& orderOfTruncation);
+		const float& orderOfTruncation,
+		const float& fgtErrorTolerance,
+		CoherentPointDrift::FGTCache* fgtCache);
 	void MStep(
 		const GpuCloud& cloudBefore,
 		const GpuCloud& cloudAfter,
@@ -62,19 +66,25 @@ namespace
 		float* scale,
 		float* sigmaSquared);
 
+	// Same O(N + M) formulation as CPU version: var(before) + var(after) + |mean(before) - mean(after)|^2, in double precision
 	float CalculateSigmaSquared(const GpuCloud& cloudBefore, const GpuCloud& cloudAfter)
 	{
-		if (cloudBefore.size() > cloudAfter.size())
-		{
-			const auto functor = Functors::CalculateSigmaSquaredInRow(cloudAfter);
-			return thrust::transform_reduce(thrust::device, cloudBefore.begin(), cloudBefore.end(), functor, 0.0f, thrust::plus<float>()) / (float)(3 * cloudBefore.size() * cloudAfter.size());
-		}
-		else
-		{
-			const auto functor = Functors::CalculateSigmaSquaredInRow(cloudBefore);
-			return thrust::transform_reduce(thrust::device, cloudAfter.begin(), cloudAfter.end(), functor, 0.0f, thrust::plus<float>()) / (float)(3 * cloudBefore.size() * cloudAfter.size());
-		}
-		return -1.0f;
+		const auto get_mean = [](const GpuCloud& cloud) {
+			const auto sum = thrust::transform_reduce(thrust::device, cloud.begin(), cloud.end(), Functors::ConvertToDouble(), glm::dvec3(0.0), thrust::plus<glm::dvec3>());
+			return sum / static_cast<double>(cloud.size());
+		};
+
+		const auto get_variance = [](const GpuCloud& cloud, const glm::dvec3& mean) {
+			const auto functor = Functors::CalculateDistanceSquaredToPoint(mean);
+			return thrust::transform_reduce(thrust::device, cloud.begin(), cloud.end(), functor, 0.0, thrust::plus<double>()) / static_cast<double>(cloud.size());
+		};
+
+		const auto meanBefore = get_mean(cloudBefore);
+		const auto meanAfter = get_mean(cloudAfter);
+		const auto meanDifference = meanBefore - meanAfter;
+
+		const double meanSquaredDistance = get_variance(cloudBefore, meanBefore) + get_variance(cloudAfter, meanAfter) + glm::dot(meanDifference, meanDifference);
+		return static_cast<float>(meanSquaredDistance / 3.0);
 	}
 
 	void ComputePMatrix(
@@ -130,18 +140,20 @@ namespace
 		const glm::vec3& translationVector,
 		const float& scale,
 		const float& ratioOfFarField,
-		const float& orderOfTruncation)
+		const float& orderOfTruncation,
+		const float& fgtErrorTolerance,
+		CoherentPointDrift::FGTCache* fgtCache)
 	{
 		if (fgt == ApproximationType::Full)
 		{
 			if (*sigmaSquared < 0.05)
 				*sigmaSquared = 0.05;
-			ComputePMatrixWithFGTOnCPU(cloudBeforeCPU, cloudAfterCPU, probabilities, weight, *sigmaSquared, sigmaSquaredInit, rotationMatrix, translationVector, scale, ratioOfFarField, orderOfTruncation);
+			ComputePMatrixWithFGTOnCPU(cloudBeforeCPU, cloudAfterCPU, probabilities, weight, *sigmaSquared, sigmaSquaredInit, rotationMatrix, translationVector, scale, ratioOfFarField, orderOfTruncation, fgtErrorTolerance, fgtCache);
 		}
 		else if (fgt == ApproximationType::Hybrid)
 		{
 			if (*sigmaSquared > 0.015 * sigmaSquaredInit)
-				ComputePMatrixWithFGTOnCPU(cloudBeforeCPU, cloudAfterCPU, probabilities, weight, *sigmaSquared, sigmaSquaredInit, rotationMatrix, translationVector, scale, ratioOfFarField, orderOfTruncation);
+				ComputePMatrixWithFGTOnCPU(cloudBeforeCPU, cloudAfterCPU, probabilities, weight, *sigmaSquared, sigmaSquaredInit, rotationMatrix, translationVector, scale, ratioOfFarField, orderOfTruncation, fgtErrorTolerance, fgtCache);
 			else
 				ComputePMatrix(cloudTransformed, cloudAfter, probabilities, constant, *sigmaSquared, true, 1e-3f);
 		}
@@ -158,10 +170,12 @@ namespace
 		const glm::vec3& translationVector,
 		const float& scale,
 		const float& ratioOfFarField,
-		const float& orderOfTruncation)
+		const float& orderOfTruncation,
+		const float& fgtErrorTolerance,
+		CoherentPointDrift::FGTCache* fgtCache)
 	{
 		auto cloudTransformedCPU = Common::GetTransformedCloud(cloudBeforeCPU, rotationMatrix, translationVector, scale);
-		auto prob = CoherentPointDrift::ComputePMatrixWithFGT(cloudTransformedCPU, cloudAfterCPU, weight, sigmaSquared, sigmaSquaredInit, ratioOfFarField, orderOfTruncation);
+		auto prob = CoherentPointDrift::ComputePMatrixWithFGT(cloudTransformedCPU, cloudAfterCPU, weight, sigmaSquared, sigmaSquaredInit, ratioOfFarField, orderOfTruncation, fgtErrorTolerance, fgtCache);
 		Eigen::Matrix<float, -1, 3, Eigen::RowMajor> px = prob.px;
 		cudaMemcpy(thrust::raw_pointer_cast(probabilities.p1.data()), prob.p1.data(), cloudBeforeCPU.size() * sizeof(float), cudaMemcpyHostToDevice);
 		cudaMemcpy(thrust::raw_pointer_cast(probabilities.pt1.data()), prob.pt1.data(), cloudAfterCPU.size() * sizeof(float), cudaMemcpyHostToDevice);
@@ -312,6 +326,7 @@ namespace
 		Common::ApproximationType fgt,
 		const float& ratioOfFarField,
 		const float& orderOfTruncation,
+		const float& fgtErrorTolerance,
 		const std::vector<Point_f>& cloudBeforeCPU,
 		const std::vector<Point_f>& cloudAfterCPU)
 	{
@@ -336,14 +351,17 @@ namespace
 		float ntol = tolerance + 10.0f;
 		float l = 0.0f;
 		GpuCloud transformedCloud = cloudBefore;
+		//FGT state reused by E-steps
+		CoherentPointDrift::FGTCache fgtCache;
 		//EM optimization
 		while (*iterations < maxIterations && ntol > tolerance && sigmaSquared > eps)
 		{
 			//E-step
-			if (fgt == Common::ApproximationType::None)
+			// FGT runs on CPU, so automatic choice keeps the exact E-step on GPU
+			if (fgt == Common::ApproximationType::None || fgt == Common::ApproximationType::Auto)
 				ComputePMatrix(transformedCloud, cloudAfter, probabilities, constant, sigmaSquared, false, -1.0f);
 			else
-				ComputePMatrixFast(transformedCloud, cloudAfter, probabilities, constant, weight, &sigmaSquared, sigmaSquared_init, fgt, cloudBeforeCPU, cloudAfterCPU, rotationMatrix, translationVector, scale, ratioOfFarField, orderOfTruncation);
+				ComputePMatrixFast(transformedCloud, cloudAfter, probabilities, constant, weight, &sigmaSquared, sigmaSquared_init, fgt, cloudBeforeCPU, cloudAfterCPU, rotationMatrix, translationVector, scale, ratioOfFarField, orderOfTruncation, fgtErrorTolerance, &fgtCache);
 
 			ntol = std::abs((probabilities.error - l) / probabilities.error);
 			l = probabilities.error;
@@ -373,7 +391,8 @@ std::pair<glm::mat3, glm::vec3> GetCudaCpdTransformationMatrix(
 	int* iterations,
 	float* error,
 	const float& ratioOfFarField,
-	const float& orderOfTruncation)
+	const float& orderOfTruncation,
+	const float& fgtErrorTolerance)
 {
 	
 	GpuCloud before(cloudBefore.size());
@@ -382,5 +401,5 @@ std::pair<glm::mat3, glm::vec3> GetCudaCpdTransformationMatrix(
 	checkCudaErrors(cudaMemcpy(thrust::raw_pointer_cast(before.data()), cloudBefore.data(), cloudBefore.size() * sizeof(glm::vec3), cudaMemcpyHostToDevice));
 	checkCudaErrors(cudaMemcpy(thrust::raw_pointer_cast(after.data()), cloudAfter.data(), cloudAfter.size() * sizeof(glm::vec3), cudaMemcpyHostToDevice));
 
-	return CudaCPD(before, after, iterations, error, eps, weight, const_scale, maxIterations, tolerance, fgt, ratioOfFarField, orderOfTruncation, cloudBefore, cloudAfter);
+	return CudaCPD(before, after, iterations, error, eps, weight, const_scale, maxIterations, tolerance, fgt, ratioOfFarField, orderOfTruncation, fgtErrorTolerance, cloudBefore, cloudAfter);
 }
@@ -14,4 +14,5 @@ std::pair<glm::mat3, glm::vec3> GetCudaCpdTransformationMatrix(
 	int* iterations,
 	float* error,
 	const float& ratioOfFarField,
-	const float& orderOfTruncation);
+	const float& orderOfTruncation,
+	const float& fgtErrorTolerance);
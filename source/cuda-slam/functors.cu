@@ -87,20 +87,17 @@ namespace Functors
 		}
 	}
 
-	CalculateSigmaSquaredInRow::CalculateSigmaSquaredInRow(const thrust::device_vector<glm::vec3>& cloud)
+	__device__ __host__ glm::dvec3 ConvertToDouble::operator()(const glm::vec3& vector)
 	{
-		this->cloud = thrust::raw_pointer_cast(cloud.data());
-		this->cloudSize = cloud.size();
+		return glm::dvec3(vector);
 	}
 
-	__device__ __host__ float CalculateSigmaSquaredInRow::operator()(const glm::vec3& vector)
+	CalculateDistanceSquaredToPoint::CalculateDistanceSquaredToPoint(const glm::dvec3& point) : point(point) {}
+
+	__device__ __host__ double CalculateDistanceSquaredToPoint::operator()(const glm::vec3& vector)
 	{
-		float sum = 0.0f;
-		for (int i = 0; i < cloudSize; i++)
-		{
-			sum += GetDistanceSquared(vector, cloud[i]);
-		}
-		return sum;
+		const auto d = glm::dvec3(vector) - point;
+		return d.x * d.x + d.y * d.y + d.z * d.z;
 	}
 
 	CalculateDenominator::CalculateDenominator(
@@ -61,15 +61,19 @@ namespace Functors
 		int length = 0;
 	};
 
-	struct CalculateSigmaSquaredInRow : thrust::unary_function<glm::vec3, float>
+	struct ConvertToDouble : thrust::unary_function<glm::vec3, glm::dvec3>
 	{
-		CalculateSigmaSquaredInRow(const thrust::device_vector<glm::vec3>& cloud);
+		__device__ __host__ glm::dvec3 operator()(const glm::vec3& vector);
+	};
+
+	struct CalculateDistanceSquaredToPoint : thrust::unary_function<glm::vec3, double>
+	{
+		CalculateDistanceSquaredToPoint(const glm::dvec3& point);
 
-		__device__ __host__ float operator()(const glm::vec3& vector);
+		__device__ __host__ double operator()(const glm::vec3& vector);
 
 	private:
-		const glm::vec3* cloud = nullptr;
-		int cloudSize = 0;
+		glm::dvec3 point;
 	};
 
 	struct CalculateDenominator : thrust::unary_function<thrust::tuple<glm::vec3, int>, float>
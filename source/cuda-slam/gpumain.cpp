@@ -22,12 +22,15 @@ namespace {
 			case ComputationMethod::NoniterativeIcp:
 				return GetCudaNicpTransformationMatrix(
 					before, after,
-					configuration.ConvergenceEpsilon, configuration.NicpIterations, configuration.NicpBatchSize, configuration.ApproximationType, configuration.NicpSubcloudSize,
+					configuration.ConvergenceEpsilon, configuration.NicpIterations, configuration.NicpBatchSize,
+					// automatic approximation only concerns CPD, errors are computed exactly
+					configuration.ApproximationType == ApproximationType::Auto ? ApproximationType::None : configuration.ApproximationType,
+					configuration.NicpSubcloudSize,
 					iterations, error);
 			case ComputationMethod::Cpd:
 				return GetCudaCpdTransformationMatrix(before, after,
 					configuration.ConvergenceEpsilon, configuration.CpdWeight, configuration.CpdConstScale, maxIterations, configuration.CpdTolerance, configuration.ApproximationType,
-					iterations, error, configuration.RatioOfFarField, configuration.OrderOfTruncation);
+					iterations, error, configuration.RatioOfFarField, configuration.OrderOfTruncation, configuration.FgtErrorTolerance.value_or(0.0f));
 			default:
 				assert(false); //unknown method
 				return GetCudaIcpTransformationMatrix(
@@ -39,7 +42,7 @@ namespace {
 
 	int RunGpuTests()
 	{ 
-		srand(Tests::RANDOM_SEED);
+		Common::SetRandomSeed(Tests::RANDOM_SEED);
 
 		const auto methods = { ComputationMethod::Cpd };
 		Tests::RunTestSet(GetSizesTestSet, GetGpuSlamResult, "sizes", methods);
@@ -52,6 +55,7 @@ int main(int argc, char** argv)
 #ifdef TEST
 	return RunGpuTests();
 #else
-	return Main(argc, argv, "Gpu Slam", GetGpuSlamResult);
+	// non-rigid CPD is implemented only on CPU
+	return Main(argc, argv, "Gpu Slam", GetGpuSlamResult, { ComputationMethod::NonRigidCpd });
 #endif
 }
@@ -8,14 +8,15 @@ using namespace Common;
 
 namespace
 {
-	void PrepareMatricesForParallelSVD(const GpuCloud& cloudBefore, const GpuCloud& cloudAfter, int batchSize, NonIterativeSLAMArgs& args)
+	void PrepareMatricesForParallelSVD(const GpuCloud& cloudBefore, const GpuCloud& cloudAfter, int firstRepetition, int batchSize, NonIterativeSLAMArgs& args)
 	{
 		int cloudSize = std::min(cloudBefore.size(), cloudAfter.size());
 
 		for (int i = 0; i < batchSize; i++)
 		{
-			// Generate permutation
-			std::vector<int> h_permutation = GetRandomPermutationVector(cloudSize);
+			// Generate permutation, every repetition from its own stream like on CPU
+			RandomStream permutationRandom(GetRandomSeed(), RandomPurpose::NicpRepetition, firstRepetition + i);
+			std::vector<int> h_permutation = GetRandomPermutationVector(cloudSize, permutationRandom);
 			IndexIterator d_permutation(h_permutation.size());
 			thrust::copy(h_permutation.begin(), h_permutation.end(), d_permutation.begin());
 			ApplyPermutation(args.alignedCloudBefore, d_permutation, args.permutedCloudBefore);
@@ -39,9 +40,9 @@ namespace
 		}
 	}
 
-	void GetSVDResultParallel(const GpuCloud& cloudBefore, const GpuCloud& cloudAfter, int batchSize, NonIterativeSLAMArgs& args, thrust::host_vector<glm::mat3>& outputBefore, thrust::host_vector<glm::mat3>& outputAfter)
+	void GetSVDResultParallel(const GpuCloud& cloudBefore, const GpuCloud& cloudAfter, int firstRepetition, int batchSize, NonIterativeSLAMArgs& args, thrust::host_vector<glm::mat3>& outputBefore, thrust::host_vector<glm::mat3>& outputAfter)
 	{
-		PrepareMatricesForParallelSVD(cloudBefore, cloudAfter, batchSize, args);
+		PrepareMatricesForParallelSVD(cloudBefore, cloudAfter, firstRepetition, batchSize, args);
 
 		// Run SVD for cloud before
 		args.svdHelperBefore.RunSVD(args.preparedBeforeClouds, batchSize);
@@ -58,7 +59,8 @@ namespace
 
 		outputSubcloud.resize(subcloudSize);
 
-		std::vector<int> h_indices = GetRandomPermutationVector(cloud.size());
+		RandomStream subcloudRandom(GetRandomSeed(), RandomPurpose::NicpSubcloud);
+		std::vector<int> h_indices = GetRandomPermutationVector(cloud.size(), subcloudRandom);
 		h_indices.resize(subcloudSize);
 		thrust::device_vector<int> d_indices(h_indices);
 
@@ -78,7 +80,7 @@ std::pair<glm::mat3, glm::vec3> CudaNonIterative(const GpuCloud& before, const G
 	std::pair<glm::mat3, glm::vec3> currentTransformation;
 	thrust::host_vector<glm::mat3> matricesBefore(batchSize);
 	thrust::host_vector<glm::mat3> matricesAfter(batchSize);
-	std::vector<NonIterativeSlamResult> bestResults(resultsNumber);
+	NonIterativeResultHeap bestResults(resultsNumber);
 
 	// Split number of repetitions to batches
 	auto batchesCount = maxRepetitions / batchSize;
@@ -113,7 +115,7 @@ std::pair<glm::mat3, glm::vec3> CudaNonIterative(const GpuCloud& before, const G
 				break;
 		}
 
-		GetSVDResultParallel(before, after, threadsToRun, args, matricesBefore, matricesAfter);
+		GetSVDResultParallel(before, after, *repetitions, threadsToRun, args, matricesBefore, matricesAfter);
 		*repetitions += threadsToRun;
 
 		for (int j = 0; j < threadsToRun; j++)
@@ -148,7 +150,7 @@ std::pair<glm::mat3, glm::vec3> CudaNonIterative(const GpuCloud& before, const G
 				*error = GetMeanSquaredError(nonPermutedIndices, before, after);
 
 				NonIterativeSlamResult transformationResult(rotationMatrix, translationVector, *error);
-				StoreResultIfOptimal(bestResults, transformationResult, resultsNumber);
+				bestResults.Push(transformationResult, i * batchSize + j);
 			}
 		}
 	}
@@ -158,16 +160,16 @@ std::pair<glm::mat3, glm::vec3> CudaNonIterative(const GpuCloud& before, const G
 	if (approximationType != ApproximationType::None)
 	{
 		minError = std::numeric_limits<float>::max();
-		for (int i = 0; i < bestResults.size(); i++)
+		for (const auto& entry : bestResults.GetSorted())
 		{
-			TransformCloud(subcloud, transformedSubcloud, bestResults[i].getTransformationMatrix());
+			TransformCloud(subcloud, transformedSubcloud, entry.result.getTransformationMatrix());
 			GetCorrespondingPoints(permutedIndices, transformedSubcloud, after);
 			*error = GetMeanSquaredError(permutedIndices, transformedSubcloud, after);
 
 			if (*error < minError)
 			{
 				minError = *error;
-				bestTransformation = bestResults[i].getTransformation();
+				bestTransformation = entry.result.getTransformation();
 
 				if (minError <= eps)
 				{